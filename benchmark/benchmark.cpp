@@ -1,9 +1,703 @@
 ﻿#define _CRT_SECURE_NO_WARNINGS
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include <ubench/ubench.hpp>
+#include <theater/atomic_cv.hpp>
+#include <theater/activity.hpp>
+#include <theater/mpsc_queue.hpp>
+#include <theater/intrusive_mpsc_queue.hpp>
+#include <theater/spsc_queue.hpp>
+#include <theater/mpmc_queue.hpp>
+#include <theater/multicast_queue.hpp>
+#include <theater/priority_activity.hpp>
+
+
+#if defined(_WIN32)
+constexpr char const* wait_primitive = "WaitOnAddress";
+#else
+constexpr char const* wait_primitive = "futex";
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// One round trip is two wake-to-run transitions: main -> echo -> main
+void atomic_cv_wake_to_run() {
+
+  theater::atomic_cv ping, pong;
+  std::atomic<bool> done{false};
+
+  std::thread echo{[&]{
+    for(;;) {
+      ping.wait();
+      ping.reset();
+      if(done.load(std::memory_order_relaxed))
+        return;
+      pong.notify_one();
+    }
+  }};
+
+  auto const result = ubench::run([&]{
+    ping.notify_one();
+    pong.wait();
+    pong.reset();
+  });
+
+  done.store(true, std::memory_order_relaxed);
+  ping.notify_one();
+  echo.join();
+
+  std::cout << "atomic_cv (" << wait_primitive << ") wake-to-run round trip: "
+            << result << std::endl;
+}
+
+
+// Producer publishes back to back while the worker drains, so the worker
+// should be parked only rarely and publish should skip the wake syscall
+template<typename W>
+void activity_wakes_per_message(char const* name) {
+
+  constexpr int count = 1000000;
+  theater::activity<int, theater::mpsc_queue<int>, W> target;
+  target.reserve(4096);
+  std::atomic<int> received{0};
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      batch.fetched();
+      received.fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+
+  auto const started = std::chrono::steady_clock::now();
+
+  for(int i = 0; i != count; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  while(received.load(std::memory_order_relaxed) != count)
+    std::this_thread::yield();
+
+  std::chrono::duration<double, std::nano> const elapsed =
+      std::chrono::steady_clock::now() - started;
+
+  std::cout << "activity::publish sustained (" << name << "): "
+            << std::setprecision(1) << std::fixed << elapsed.count() / count
+            << " ns/message, " << std::setprecision(4)
+            << double(target.wakes_count()) / count << " wakes/message" << std::endl;
+}
+
+
+// Many more producers than cores keep the mailbox full, W decides if the
+// blocked ones burn cores in a yield loop or sleep until the consumer frees room
+template<typename W>
+void saturated_mailbox(char const* name) {
+
+  constexpr int producers_count = 32;
+  constexpr int per_producer = 1 << 16;
+  constexpr int total = producers_count * per_producer;
+  theater::activity<int, theater::mpsc_queue<int, theater::split_layout, W>> target;
+  target.reserve(1024);
+  std::atomic<int> received{0};
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      batch.fetched();
+      received.fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+
+  auto const started = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> producers;
+  for(int i = 0; i != producers_count; ++i)
+    producers.emplace_back([&]{
+      for(int j = 0; j != per_producer; ++j) {
+        auto const n = target.claim();
+        target[n] = j;
+        target.publish(n);
+      }
+    });
+
+  for(auto& each: producers)
+    each.join();
+
+  while(received.load(std::memory_order_relaxed) != total)
+    std::this_thread::yield();
+
+  std::chrono::duration<double, std::nano> const elapsed =
+      std::chrono::steady_clock::now() - started;
+
+  std::cout << "saturated mailbox (" << name << ", " << producers_count << " producers, "
+            << std::thread::hardware_concurrency() << " cores): "
+            << std::setprecision(1) << std::fixed << elapsed.count() / total
+            << " ns/message, " << target.blocks_count() << " blocks" << std::endl;
+}
+
+
+// One producer thread pushes count integers, the calling thread drains them
+template<typename Q>
+void one_producer_throughput(char const* name) {
+
+  constexpr int count = 10000000;
+  Q queue(4096);
+
+  auto const started = std::chrono::steady_clock::now();
+
+  std::thread producer{[&]{
+    for(int i = 0; i != count; ++i) {
+      auto const n = queue.claim();
+      queue[n] = i;
+      queue.publish(n);
+    }
+  }};
+
+  long long sum = 0;
+  for(int received = 0; received != count; ) {
+    auto const n = queue.try_fetch();
+    if(!n) {
+      std::this_thread::yield();
+      continue;
+    }
+    sum += queue[n];
+    queue.fetched();
+    ++received;
+  }
+
+  producer.join();
+
+  std::chrono::duration<double, std::nano> const elapsed =
+      std::chrono::steady_clock::now() - started;
+
+  std::cout << name << " one producer: " << std::setprecision(1) << std::fixed
+            << elapsed.count() / count << " ns/message" << std::endl;
+}
+
+
+double mpmc_throughput(int producers_count, int consumers_count) {
+
+  constexpr int count = 1 << 18;
+  int const per_producer = count / producers_count;
+  int const total = per_producer * producers_count;
+  theater::mpmc_queue<int> queue(4096);
+  std::atomic<int> received{0};
+
+  auto const started = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  for(int i = 0; i != consumers_count; ++i)
+    threads.emplace_back([&]{
+      while(received.load(std::memory_order_relaxed) != total) {
+        auto const n = queue.try_fetch();
+        if(!n) {
+          std::this_thread::yield();
+          continue;
+        }
+        queue.fetched(n);
+        received.fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+
+  for(int i = 0; i != producers_count; ++i)
+    threads.emplace_back([&]{
+      for(int j = 0; j != per_producer; ++j) {
+        auto const n = queue.claim();
+        queue[n] = j;
+        queue.publish(n);
+      }
+    });
+
+  for(auto& each: threads)
+    each.join();
+
+  std::chrono::duration<double> const elapsed =
+      std::chrono::steady_clock::now() - started;
+
+  return total / elapsed.count() / 1e6;
+}
+
+
+void mpmc_scaling() {
+
+  int const counts[] = {1, 2, 4, 8, 16};
+
+  std::cout << "mpmc_queue throughput, M messages/s (producers x consumers)" << std::endl;
+  std::cout << "     ";
+  for(int consumers: counts)
+    std::cout << std::setw(8) << consumers;
+  std::cout << std::endl;
+
+  for(int producers: counts) {
+    std::cout << std::setw(5) << producers;
+    for(int consumers: counts)
+      std::cout << std::setw(8) << std::setprecision(2) << std::fixed
+                << mpmc_throughput(producers, consumers);
+    std::cout << std::endl;
+  }
+}
+
+
+struct large_message {
+  int64_t value;
+  char payload[248];
+};
+
+
+struct market_event {
+  int64_t price;
+  int64_t quantity;
+  int64_t route;
+  char payload[40];
+};
+
+
+// decode -> enrich -> route as stages over one ring, each stage changes the
+// slot in place and its cursor is the sequence barrier of the next one
+void pipeline_in_place() {
+
+  constexpr int count = 1 << 20;
+  theater::multicast_queue<market_event, theater::park_wait> ring{4096, 3};
+  auto decode = ring.subscribe_stage(0);
+  auto enrich = ring.subscribe_stage(1, 0);
+  auto route = ring.subscribe_stage(2, 1);
+  int64_t routed = 0;
+
+  auto const started = std::chrono::steady_clock::now();
+
+  std::thread decoder{[&]{
+    for(int i = 0; i != count; ++i) {
+      auto const n = decode.fetch();
+      decode[n].price *= 100;
+      decode.fetched();
+    }
+  }};
+
+  std::thread enricher{[&]{
+    for(int i = 0; i != count; ++i) {
+      auto const n = enrich.fetch();
+      enrich[n].route = enrich[n].price & 7;
+      enrich.fetched();
+    }
+  }};
+
+  std::thread router{[&]{
+    for(int i = 0; i != count; ++i) {
+      auto const n = route.fetch();
+      routed += route[n].route;
+      route.fetched();
+    }
+  }};
+
+  for(int i = 0; i != count; ++i) {
+    auto const n = ring.claim();
+    ring[n].price = i;
+    ring[n].quantity = 1;
+    ring.publish(n);
+  }
+
+  decoder.join();
+  enricher.join();
+  router.join();
+
+  std::chrono::duration<double, std::nano> const elapsed =
+      std::chrono::steady_clock::now() - started;
+
+  std::cout << "pipeline in place (3 stages): "
+            << std::setprecision(1) << std::fixed << elapsed.count() / count
+            << " ns/message" << std::endl;
+}
+
+
+// The same pipeline as three activities, every stage copies the message
+// into the mailbox of the next one
+void pipeline_chained_activities() {
+
+  constexpr int count = 1 << 20;
+  theater::activity<market_event> route;
+  theater::activity<market_event> enrich;
+  theater::activity<market_event> decode;
+  route.reserve(4096);
+  enrich.reserve(4096);
+  decode.reserve(4096);
+  int64_t routed = 0;
+  std::atomic<int> received{0};
+
+  route.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      routed += batch[n].route;
+      batch.fetched();
+      received.fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+
+  enrich.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      auto const next = route.claim();
+      route[next] = batch[n];
+      route[next].route = route[next].price & 7;
+      batch.fetched();
+      route.publish(next);
+    }
+  });
+
+  decode.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      auto const next = enrich.claim();
+      enrich[next] = batch[n];
+      enrich[next].price *= 100;
+      batch.fetched();
+      enrich.publish(next);
+    }
+  });
+
+  auto const started = std::chrono::steady_clock::now();
+
+  for(int i = 0; i != count; ++i) {
+    auto const n = decode.claim();
+    decode[n].price = i;
+    decode[n].quantity = 1;
+    decode.publish(n);
+  }
+
+  while(received.load(std::memory_order_relaxed) != count)
+    std::this_thread::yield();
+
+  std::chrono::duration<double, std::nano> const elapsed =
+      std::chrono::steady_clock::now() - started;
+
+  decode.stop();
+  enrich.stop();
+  route.stop();
+
+  std::cout << "pipeline of chained activities (3 stages): "
+            << std::setprecision(1) << std::fixed << elapsed.count() / count
+            << " ns/message" << std::endl;
+}
+
+
+struct timed_message {
+  int64_t sent_ns;
+  bool control;
+};
+
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Worker handles a bulk message in about a microsecond, handles a control
+// message at once and records how long it waited
+struct latency_recorder {
+
+  static constexpr int controls_count = 100;
+
+  std::atomic<int> controls{0};
+  int64_t total_ns{0};
+  int64_t max_ns{0};
+
+  void handle(timed_message const& message) {
+    if(!message.control) {
+      for(int i = 0; i != 200; ++i)
+        theater::cpu_relax();
+      return;
+    }
+    int64_t const waited = now_ns() - message.sent_ns;
+    total_ns += waited;
+    max_ns = (std::max)(max_ns, waited);
+    controls.fetch_add(1, std::memory_order_release);
+  }
+
+
+  void report(char const* name) const {
+    std::cout << "control message latency (" << name << "): "
+              << std::setprecision(1) << std::fixed
+              << double(total_ns) / controls_count / 1000 << " us mean, "
+              << double(max_ns) / 1000 << " us max" << std::endl;
+  }
+}; // latency_recorder
+
+
+// Bulk producer keeps the mailbox full, control messages are sent every
+// millisecond. Send(control, message) publishes into the mailbox or a lane
+template<typename Send>
+void send_with_backlog(latency_recorder& recorder, Send&& send) {
+
+  std::atomic<bool> done{false};
+  std::thread bulk{[&]{
+    while(!done.load(std::memory_order_relaxed))
+      send(false, timed_message{0, false});
+  }};
+
+  for(int i = 0; i != latency_recorder::controls_count; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    send(true, timed_message{now_ns(), true});
+    while(recorder.controls.load(std::memory_order_acquire) != i + 1)
+      std::this_thread::yield();
+  }
+
+  done.store(true, std::memory_order_relaxed);
+  bulk.join();
+}
+
+
+void control_latency_single_mailbox() {
+
+  theater::activity<timed_message> target;
+  target.reserve(4096);
+  latency_recorder recorder;
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      recorder.handle(batch[n]);
+      batch.fetched();
+    }
+  });
+
+  send_with_backlog(recorder, [&](bool, timed_message const& message) {
+    auto const n = target.claim();
+    target[n] = message;
+    target.publish(n);
+  });
+
+  target.stop();
+  recorder.report("one mailbox");
+}
+
+
+void control_latency_priority_lanes() {
+
+  theater::priority_activity<timed_message, 2> target;
+  target.reserve(4096);
+  latency_recorder recorder;
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      recorder.handle(batch[n]);
+      batch.fetched();
+    }
+  });
+
+  send_with_backlog(recorder, [&](bool control, timed_message const& message) {
+    std::size_t const lane = control ? 0 : 1;
+    auto const n = target.claim(lane);
+    target.at(lane, n) = message;
+    target.publish(lane, n);
+  });
+
+  target.stop();
+  recorder.report("priority lanes");
+}
+
+
+// Hardware cache misses of the calling thread and of threads it starts
+// afterwards, counts of those are added once they are joined. -1 where
+// counters are not available
+struct cache_miss_counter {
+
+  cache_miss_counter(cache_miss_counter const&) = delete;
+  cache_miss_counter& operator = (cache_miss_counter const&) = delete;
+
+#if defined(__linux__)
+
+  cache_miss_counter() {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+
+
+  ~cache_miss_counter() {
+    if(fd_ != -1)
+      close(fd_);
+  }
+
+
+  long long count() const {
+    uint64_t value = 0;
+    if(fd_ == -1 || read(fd_, &value, sizeof(value)) != sizeof(value))
+      return -1;
+    return (long long)value;
+  }
+
+private:
+
+  int fd_{-1};
+
+#else
+
+  cache_miss_counter() = default;
+  long long count() const { return -1; }
+
+#endif
+};
+
+
+// Split layout touches two lines per message, cell layout one; padded cells
+// also stop producers of neighbouring slots from sharing a line. Cache
+// misses are counted for the consumer and all producers
+template<typename T, typename L>
+void mpsc_layout_throughput(char const* name, int producers_count) {
+
+  constexpr int count = 1 << 20;
+  int const per_producer = count / producers_count;
+  int const total = per_producer * producers_count;
+  theater::mpsc_queue<T, L> queue(4096);
+
+  cache_miss_counter misses;
+  auto const started = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> producers;
+  for(int i = 0; i != producers_count; ++i)
+    producers.emplace_back([&]{
+      for(int j = 0; j != per_producer; ++j) {
+        auto const n = queue.claim();
+        std::memcpy(&queue[n], &j, sizeof(j));
+        queue.publish(n);
+      }
+    });
+
+  for(int received = 0; received != total; ) {
+    auto const n = queue.try_fetch();
+    if(!n) {
+      std::this_thread::yield();
+      continue;
+    }
+    queue.fetched();
+    ++received;
+  }
+
+  for(auto& each: producers)
+    each.join();
+
+  std::chrono::duration<double, std::nano> const elapsed =
+      std::chrono::steady_clock::now() - started;
+
+  long long const missed = misses.count();
+
+  std::cout << "mpsc_queue " << name << " (" << sizeof(T) << " bytes, "
+            << producers_count << " producers): " << std::setprecision(1)
+            << std::fixed << elapsed.count() / total << " ns/message, ";
+  if(missed < 0)
+    std::cout << "cache misses n/a" << std::endl;
+  else
+    std::cout << std::setprecision(2) << double(missed) / total
+              << " cache misses/message" << std::endl;
+}
+
+
+template<typename T>
+void mpsc_layouts(int producers_count) {
+  mpsc_layout_throughput<T, theater::split_layout>("split", producers_count);
+  mpsc_layout_throughput<T, theater::cell_layout<false>>("cell", producers_count);
+  mpsc_layout_throughput<T, theater::cell_layout<true>>("padded cell", producers_count);
+}
+
+
+struct pooled_event: theater::intrusive_hook {
+  int64_t value;
+  char payload[1016];
+};
+
+
+// Events come from a pool of 4096 that the producer reuses once the consumer
+// is done; the ring copies every event, the intrusive queue links it
+template<typename Q>
+void pooled_handoff(char const* name) {
+
+  constexpr int count = 1 << 20;
+  constexpr int pool_size = 4096;
+  std::vector<pooled_event> pool(pool_size);
+  std::atomic<int> released{0};
+  Q queue;
+  if constexpr(!std::is_same_v<Q, theater::intrusive_mpsc_queue<pooled_event>>)
+    queue.reserve(pool_size);
+
+  auto const started = std::chrono::steady_clock::now();
+
+  std::thread producer{[&]{
+    for(int i = 0; i != count; ++i) {
+      while(i - released.load(std::memory_order_acquire) >= pool_size)
+        std::this_thread::yield();
+      pooled_event& event = pool[i % pool_size];
+      event.value = i;
+      if constexpr(std::is_same_v<Q, theater::intrusive_mpsc_queue<pooled_event>>)
+        queue.push(&event);
+      else {
+        auto const n = queue.claim();
+        queue[n] = event;
+        queue.publish(n);
+      }
+    }
+  }};
+
+  long long sum = 0;
+  for(int received = 0; received != count; ) {
+    auto const n = queue.try_fetch();
+    if(!n) {
+      std::this_thread::yield();
+      continue;
+    }
+    sum += queue[n].value;
+    queue.fetched();
+    released.store(++received, std::memory_order_release);
+  }
+
+  producer.join();
+
+  std::chrono::duration<double, std::nano> const elapsed =
+      std::chrono::steady_clock::now() - started;
+
+  std::cout << name << " (" << sizeof(pooled_event) << " bytes): " << std::setprecision(1)
+            << std::fixed << elapsed.count() / count << " ns/message" << std::endl;
+}
 
 
 int main() {
 
+  atomic_cv_wake_to_run();
+  activity_wakes_per_message<theater::park_wait>("park");
+  activity_wakes_per_message<theater::yield_wait>("yield");
+  activity_wakes_per_message<theater::backoff_wait>("backoff");
+  activity_wakes_per_message<theater::spin_wait>("spin");
+  saturated_mailbox<theater::yield_wait>("yield");
+  saturated_mailbox<theater::park_wait>("park");
+  one_producer_throughput<theater::mpsc_queue<int>>("mpsc_queue");
+  one_producer_throughput<theater::spsc_queue<int>>("spsc_queue");
+  mpmc_scaling();
+  pipeline_in_place();
+  pipeline_chained_activities();
+  control_latency_single_mailbox();
+  control_latency_priority_lanes();
+  for(int producers: {1, 4}) {
+    mpsc_layouts<int64_t>(producers);
+    mpsc_layouts<large_message>(producers);
+  }
+  pooled_handoff<theater::mpsc_queue<pooled_event>>("mpsc_queue copy");
+  pooled_handoff<theater::intrusive_mpsc_queue<pooled_event>>("intrusive_mpsc_queue link");
+
   return 0;
 }
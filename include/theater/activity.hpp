@@ -26,19 +26,23 @@
 
 #include <thread>
 #include <memory>
+#include <utility>
 #include "mpsc_queue.hpp"
-#include "atomic_cv.hpp"
+#include "wait_strategy.hpp"
 #include "queue_batch.hpp"
+#include "numa.hpp"
 
 
 namespace theater {
   
 
-  template<typename M, typename Q = mpsc_queue<M>>
+  // W is how the worker waits for new messages
+  template<typename M, typename Q = mpsc_queue<M>, typename W = park_wait>
   struct activity {
     
     using message_type = M;
     using queue_type = Q;
+    using wait_strategy = W;
     using size_type = typename Q::size_type;
     using batch = queue_batch<queue_type>;
 
@@ -48,9 +52,18 @@ namespace theater {
     ~activity() { stop(); }
     bool active() const noexcept { return worker_.joinable(); }    
     sequence claim() noexcept { return messages_.claim(); }
+    sequence_range claim_n(size_type count) noexcept { return messages_.claim_n(count); }
     message_type& operator [] (sequence n) noexcept { return messages_[n]; }
     void reserve(size_type n) noexcept { messages_.reserve(n); }
+    void reserve(size_type n, numa_node node) { messages_.reserve(n, node); }
+    void reserve(size_type n, memory_options const& options) { messages_.reserve(n, options); }
     size_type blocks_count() const noexcept { return messages_.blocks_count(); }
+    uint64_t wakes_count() const noexcept { return new_message_.wakes_count(); }
+
+    template<typename... Args>
+    message_type& emplace(sequence n, Args&&... args) {
+      return messages_.emplace(n, std::forward<Args>(args)...);
+    }
 
     template<typename Rep, typename Period>
     sequence claim_for(std::chrono::duration<Rep, Period> const& duration) noexcept {
@@ -58,9 +71,36 @@ namespace theater {
     }
     
  
+    // Wakes the worker only if it is parked in new_message_
     void publish(sequence n) noexcept {
       messages_.publish(n);
-      new_message_.notify_one();
+      new_message_.notify();
+    }
+
+
+    void publish_range(sequence first, sequence last) noexcept {
+      messages_.publish_range(first, last);
+      new_message_.notify();
+    }
+
+
+    void publish_range(sequence_range range) noexcept {
+      publish_range(range.first(), range.last());
+    }
+
+
+    bool push(message_type const* data, size_type count) noexcept {
+      if(!messages_.push(data, count))
+        return false;
+      new_message_.notify();
+      return true;
+    }
+
+
+    // Hands the message over to an intrusive mailbox without copying
+    void push(message_type* message) noexcept {
+      messages_.push(message);
+      new_message_.notify();
     }
 
 
@@ -68,18 +108,22 @@ namespace theater {
       if(!worker_.joinable() || stopping_)
         return;
       stopping_.store(true, std::memory_order_relaxed);
-      new_message_.notify_one();
+      new_message_.notify();
       worker_.join();
     }
 
 
+    // With numa_node::local() mailbox memory is moved to the node the worker starts on
     template<typename H>
-    bool run(H&& handler) {
+    bool run(H&& handler, numa_node node = numa_node{}) {
       
       if(worker_.joinable() || stopping_ || !messages_)
         return false;
       
-      worker_ = std::thread{[handler, this]() {
+      worker_ = std::thread{[handler, node, this]() {
+
+        if(node)
+          messages_.bind(node);
         
         batch batch(messages_);
 
@@ -87,8 +131,9 @@ namespace theater {
           handler(batch);
         
         while(!stopping_.load(std::memory_order_relaxed)) {
-          new_message_.wait();
-          new_message_.reset();
+          new_message_.wait([this]{
+            return stopping_.load(std::memory_order_relaxed) || !!messages_.try_fetch();
+          });
           handler(batch);
         }
         
@@ -107,7 +152,7 @@ namespace theater {
     
     std::thread worker_;
     queue_type messages_;
-    atomic_cv new_message_;
+    W new_message_;
     std::atomic<bool> stopping_{false};
 
   }; // activity
@@ -0,0 +1,111 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <atomic>
+#include <cstdint>
+
+
+#if defined(_WIN32)
+
+#include <Windows.h>
+
+#pragma comment(lib, "synchronization.lib")
+
+
+#elif defined(__linux__)
+
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+#else
+
+#error Unsupported OS
+
+#endif
+
+
+
+namespace theater {
+
+
+  // Sleeping on a 32-bit word until another thread changes it and wakes the
+  // word's sleepers: futex on Linux, WaitOnAddress on Windows. Shared words
+  // may live in memory mapped by several processes
+  namespace detail {
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+
+#if defined(_WIN32)
+
+    // Returns when word differs from expected, on timeout or spuriously,
+    // negative nanoseconds means no timeout
+    template<bool Shared = false>
+    void wait_on_address(std::atomic<uint32_t>& word, uint32_t expected, int64_t nanoseconds) noexcept {
+      static_assert(!Shared, "WaitOnAddress does not work across processes");
+      DWORD const ms = nanoseconds < 0 ? INFINITE : DWORD((nanoseconds + 999999) / 1000000);
+      WaitOnAddress(&word, &expected, sizeof(uint32_t), ms);
+    }
+
+
+    template<bool Shared = false>
+    void wake_by_address(std::atomic<uint32_t>& word, bool all) noexcept {
+      static_assert(!Shared, "WaitOnAddress does not work across processes");
+      if(all)
+        WakeByAddressAll(&word);
+      else
+        WakeByAddressSingle(&word);
+    }
+
+#elif defined(__linux__)
+
+    // Returns when word differs from expected, on timeout or spuriously,
+    // negative nanoseconds means no timeout
+    template<bool Shared = false>
+    void wait_on_address(std::atomic<uint32_t>& word, uint32_t expected, int64_t nanoseconds) noexcept {
+      timespec ts;
+      ts.tv_sec = time_t(nanoseconds / 1000000000);
+      ts.tv_nsec = long(nanoseconds % 1000000000);
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), Shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE,
+              expected, nanoseconds < 0 ? nullptr : &ts, nullptr, 0);
+    }
+
+
+    template<bool Shared = false>
+    void wake_by_address(std::atomic<uint32_t>& word, bool all) noexcept {
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), Shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE,
+              all ? INT_MAX : 1, nullptr, nullptr, 0);
+    }
+
+#endif
+
+  } // detail
+
+
+} // theater
@@ -23,81 +23,92 @@
 #pragma once
 
 
-
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 
-
-#if defined(_WIN32)
-
-#include <Windows.h>
-
-#pragma comment(lib, "synchronization.lib")
-
-
-#else
-
-#error Unsupported OS
-
-#endif
-
+#include "address_wait.hpp"
 
 
 namespace theater {
 
 
-#if defined(_WIN32)
-
-
   struct atomic_cv {
 
     atomic_cv() noexcept = default;
     atomic_cv(atomic_cv const&) = delete;
     atomic_cv& operator = (atomic_cv const&) = delete;
 
+    uint64_t wakes_count() const noexcept {
+      return wakes_count_.load(std::memory_order_relaxed);
+    }
+
+
     void notify_one() {
-      raised_ = true;
-      WakeByAddressSingle(&raised_);
+      if(!raise())
+        return;
+      wakes_count_.fetch_add(1, std::memory_order_relaxed);
+      detail::wake_by_address(raised_, false);
     }
 
 
     void notify_all() {
-      raised_ = true;
-      WakeByAddressAll(&raised_);
+      if(!raise())
+        return;
+      wakes_count_.fetch_add(1, std::memory_order_relaxed);
+      detail::wake_by_address(raised_, true);
     }
 
 
     void reset() {
-      raised_ = false;
+      raised_.store(0, std::memory_order_relaxed);
     }
 
 
     void wait() {
-      bool raised = false;
-      while(!raised_)
-        WaitOnAddress(&raised_, &raised, sizeof(bool), INFINITE);
+      if(raised_.load(std::memory_order_acquire))
+        return;
+      waiters_.fetch_add(1, std::memory_order_seq_cst);
+      while(!raised_.load(std::memory_order_acquire))
+        detail::wait_on_address(raised_, 0, -1);
+      waiters_.fetch_sub(1, std::memory_order_relaxed);
     }
 
 
     bool wait(std::chrono::milliseconds timeout) {
-      bool raised = false;
-      while(!raised_)
-        if(!WaitOnAddress(&raised_, &raised, sizeof(bool), DWORD(timeout.count())))
-          return false;
-      return true;
+      using namespace std::chrono;
+      if(raised_.load(std::memory_order_acquire))
+        return true;
+      auto const deadline = steady_clock::now() + timeout;
+      waiters_.fetch_add(1, std::memory_order_seq_cst);
+      bool raised = true;
+      while(!raised_.load(std::memory_order_acquire)) {
+        auto const left = duration_cast<nanoseconds>(deadline - steady_clock::now());
+        if(left.count() <= 0) {
+          raised = false;
+          break;
+        }
+        detail::wait_on_address(raised_, 0, left.count());
+      }
+      waiters_.fetch_sub(1, std::memory_order_relaxed);
+      return raised;
     }
 
 
   private:
 
-    bool raised_{false};
-  }; // atomic_cv
-
-#else
-
-#error Unsupported OS
-
-#endif
+    // Sleepers register in waiters_ before checking raised_, notifiers
+    // set raised_ before checking waiters_, so at least one side sees the other
+    std::atomic<uint32_t> raised_{0};
+    std::atomic<uint32_t> waiters_{0};
+    std::atomic<uint64_t> wakes_count_{0};
 
+    // Returns true if somebody may sleep on raised_ and has to be woken up
+    bool raise() noexcept {
+      raised_.store(1, std::memory_order_seq_cst);
+      return waiters_.load(std::memory_order_seq_cst) != 0;
+    }
+  }; // atomic_cv
 
 
 } // theater
@@ -0,0 +1,178 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <cstdint>
+#include <atomic>
+#include <type_traits>
+
+#include "sequence.hpp"
+#include "numa.hpp"
+
+
+namespace theater {
+
+
+  // Embedded into messages of intrusive_mpsc_queue, copies are not linked
+  struct intrusive_hook {
+
+    std::atomic<intrusive_hook*> next{nullptr};
+
+    intrusive_hook() noexcept = default;
+    intrusive_hook(intrusive_hook const&) noexcept { }
+    intrusive_hook& operator = (intrusive_hook const&) noexcept { return *this; }
+
+  }; // intrusive_hook
+
+
+  // Unbounded multiple producers single consumer queue of messages owned by
+  // the caller (Vyukov). A message derives from intrusive_hook and is linked
+  // by one exchange, nothing is copied or allocated. The message stays in
+  // the queue until the consumer calls fetched(), only then it may be reused.
+  // Sequences count fetched messages, they are valid for the consumer only
+  template<typename T>
+  struct intrusive_mpsc_queue {
+
+    using size_type = sequence::value_type;
+    using value_type = T;
+
+    static constexpr size_type cacheline = 64;
+    static constexpr bool contiguous = false;
+
+    static_assert(std::is_base_of_v<intrusive_hook, T>,
+                  "Messages should derive from intrusive_hook");
+
+
+    intrusive_mpsc_queue() noexcept { }
+    intrusive_mpsc_queue(intrusive_mpsc_queue const&) = delete;
+    intrusive_mpsc_queue& operator = (intrusive_mpsc_queue const&) = delete;
+    explicit operator bool () const noexcept { return true; }
+    size_type blocks_count() const noexcept { return 0; }
+
+
+    // Messages live in the caller's memory, nothing to move
+    bool bind(numa_node) noexcept {
+      return false;
+    }
+
+
+    // Called by the consumer: 1 if a message is ready to fetch, 0 otherwise,
+    // the list has no shared counter to make producers contend on
+    size_type size() noexcept {
+      return front_ || (front_ = pop()) ? 1 : 0;
+    }
+
+
+    T& operator [] (sequence) noexcept {
+      return *front_;
+    }
+
+
+    T const& operator [] (sequence) const noexcept {
+      return *front_;
+    }
+
+
+    // Hands the message over, it should not be touched until it is fetched
+    void push(T* message) noexcept {
+      intrusive_hook* const hook = message;
+      hook->next.store(nullptr, std::memory_order_relaxed);
+      link(hook);
+    }
+
+
+    // Returns the next message without removing it
+    sequence try_fetch() noexcept {
+      if(!front_ && !(front_ = pop()))
+        return sequence{};
+      return sequence{fetched_};
+    }
+
+
+    // Releases the message returned by try_fetch() to its owner
+    void fetched() noexcept {
+      front_ = nullptr;
+      ++fetched_;
+    }
+
+
+  private:
+
+    // Written by producers
+    alignas (cacheline)
+      std::atomic<intrusive_hook*> head_{&stub_};
+
+    // Written by consumer
+    alignas (cacheline)
+      intrusive_hook* tail_{&stub_};
+    T* front_{nullptr};
+    size_type fetched_{0};
+
+    // Stays in the list while it is empty, so producers never see nullptr
+    alignas (cacheline)
+      intrusive_hook stub_;
+
+
+    void link(intrusive_hook* hook) noexcept {
+      intrusive_hook* const prev = head_.exchange(hook, std::memory_order_acq_rel);
+      prev->next.store(hook, std::memory_order_release);
+    }
+
+
+    // nullptr if the list is empty or its last producer has not linked yet
+    T* pop() noexcept {
+
+      intrusive_hook* tail = tail_;
+      intrusive_hook* next = tail->next.load(std::memory_order_acquire);
+
+      if(tail == &stub_) {
+        if(!next)
+          return nullptr;
+        tail_ = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+      }
+
+      if(next) {
+        tail_ = next;
+        return static_cast<T*>(tail);
+      }
+
+      if(tail != head_.load(std::memory_order_acquire))
+        return nullptr;
+
+      stub_.next.store(nullptr, std::memory_order_relaxed);
+      link(&stub_);
+      next = tail->next.load(std::memory_order_acquire);
+      if(!next)
+        return nullptr;
+
+      tail_ = next;
+      return static_cast<T*>(tail);
+    }
+
+  }; // intrusive_mpsc_queue
+
+
+} // theater
@@ -0,0 +1,452 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "sequence.hpp"
+#include "queue_batch.hpp"
+
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#else
+
+#error Message journal is supported on Linux only
+
+#endif
+
+
+namespace theater {
+
+
+  enum class journal_sync {
+    none,     // pages are written back by the kernel
+    async,    // msync(MS_ASYNC) of appended pages every sync_every messages
+    data      // fdatasync every sync_every messages
+  }; // journal_sync
+
+
+  struct journal_options {
+    sequence::value_type segment_capacity{1 << 20};   // messages per segment file
+    journal_sync sync{journal_sync::none};
+    sequence::value_type sync_every{1024};
+  }; // journal_options
+
+
+  namespace detail {
+
+    // Start of every segment file, followed by messages in sequence order
+    struct alignas (64) journal_header {
+      static constexpr uint64_t expected_magic = 0x7468656174726a31;   // "theatrj1"
+
+      uint64_t magic;
+      uint64_t element_size;
+      sequence::value_type first_sequence;
+      sequence::value_type capacity;
+      std::atomic<sequence::value_type> count;
+    }; // journal_header
+
+
+    inline std::string segment_path(std::string const& prefix, sequence::value_type index) {
+      char suffix[32];
+      std::snprintf(suffix, sizeof(suffix), ".%06lld.journal", static_cast<long long>(index));
+      return prefix + suffix;
+    }
+
+  } // detail
+
+
+  // Appends messages to preallocated segment files mapped into memory,
+  // a new segment is started when the current one is full. Sequence of
+  // the first message is kept in every segment, so replay gets the same
+  // sequences the queue had
+  template<typename T>
+  struct journal_writer {
+
+    using size_type = sequence::value_type;
+    using value_type = T;
+
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Messages are stored as bytes, they should be trivially copyable");
+    static_assert(alignof(T) <= alignof(detail::journal_header), "Overaligned messages are not supported");
+
+
+    journal_writer() noexcept = default;
+    journal_writer(journal_writer const&) = delete;
+    journal_writer& operator = (journal_writer const&) = delete;
+    ~journal_writer() { close(); }
+    explicit operator bool () const noexcept { return header_ != nullptr; }
+    size_type next_sequence() const noexcept { return next_; }
+    size_type segments_count() const noexcept { return header_ ? index_ + 1 : 0; }
+
+
+    // Starts journal at prefix.000000.journal, the first message gets
+    // first_sequence. False if the prefix holds a journal already
+    bool open(std::string prefix, journal_options const& options = journal_options{},
+              size_type first_sequence = 0) {
+      close();
+      if(options.segment_capacity <= 0)
+        return false;
+      prefix_ = std::move(prefix);
+      options_ = options;
+      next_ = first_sequence;
+      index_ = 0;
+      return open_segment();
+    }
+
+
+    bool append(T const& message) noexcept {
+      return append(&message, 1);
+    }
+
+
+    // Copies messages into the mapping, rotating segments as they fill up,
+    // false if the next segment cannot be created
+    bool append(T const* data, size_type count) noexcept {
+      while(count != 0) {
+        if(!header_)
+          return false;
+        size_type const written = header_->count.load(std::memory_order_relaxed);
+        if(written == header_->capacity) {
+          ++index_;
+          if(!open_segment())
+            return false;
+          continue;
+        }
+        size_type const n = (std::min)(count, header_->capacity - written);
+        std::memcpy(messages_ + written, data, sizeof(T) * std::size_t(n));
+        header_->count.store(written + n, std::memory_order_release);
+        data += n;
+        count -= n;
+        next_ += n;
+        unsynced_ += n;
+        if(options_.sync != journal_sync::none && unsynced_ >= options_.sync_every)
+          sync();
+      }
+      return true;
+    }
+
+
+    // Flushes appended messages according to the sync policy
+    void sync() noexcept {
+      if(!header_ || unsynced_ == 0)
+        return;
+      if(options_.sync == journal_sync::data)
+        ::fdatasync(fd_);
+      else if(options_.sync == journal_sync::async) {
+        std::size_t const page = std::size_t(::sysconf(_SC_PAGESIZE));
+        auto const first = reinterpret_cast<std::uintptr_t>(messages_ + synced_) / page * page;
+        auto const last = reinterpret_cast<std::uintptr_t>(
+          messages_ + header_->count.load(std::memory_order_relaxed));
+        ::msync(reinterpret_cast<void*>(first), last - first, MS_ASYNC);
+      }
+      synced_ = header_->count.load(std::memory_order_relaxed);
+      unsynced_ = 0;
+    }
+
+
+    void close() noexcept {
+      if(!header_)
+        return;
+      sync();
+      ::munmap(header_, mapped_size_);
+      ::close(fd_);
+      header_ = nullptr;
+      messages_ = nullptr;
+      fd_ = -1;
+    }
+
+
+  private:
+
+    std::string prefix_;
+    journal_options options_;
+    size_type next_{0};
+    size_type index_{0};
+    size_type synced_{0};
+    size_type unsynced_{0};
+    int fd_{-1};
+    std::size_t mapped_size_{0};
+    detail::journal_header* header_{nullptr};
+    T* messages_{nullptr};
+
+
+    // Finishes the current segment and preallocates the next one
+    bool open_segment() noexcept {
+      close();
+      std::size_t const size = sizeof(detail::journal_header)
+        + sizeof(T) * std::size_t(options_.segment_capacity);
+      std::string const path = detail::segment_path(prefix_, index_);
+      // Never overwrites a segment, recorded history stays intact
+      int const fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+      if(fd == -1)
+        return false;
+      if(::posix_fallocate(fd, 0, off_t(size)) != 0) {
+        ::close(fd);
+        return false;
+      }
+      void* const data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if(data == MAP_FAILED) {
+        ::close(fd);
+        return false;
+      }
+      auto* const header = new(data) detail::journal_header{
+        detail::journal_header::expected_magic, sizeof(T), next_, options_.segment_capacity, {0}};
+      fd_ = fd;
+      mapped_size_ = size;
+      header_ = header;
+      messages_ = reinterpret_cast<T*>(header + 1);
+      synced_ = 0;
+      unsynced_ = 0;
+      return true;
+    }
+  }; // journal_writer
+
+
+  // Batch that appends every message to the journal before the handler
+  // sees it, so a handler may take() messages and the journal still has them.
+  // Messages that cannot be journaled stay in the queue and are not handed
+  // out, the journal is closed then and converts to false
+  template<typename B>
+  struct journaled_batch {
+
+    using size_type = typename B::size_type;
+    using value_type = typename B::value_type;
+    using journal_type = journal_writer<std::remove_const_t<value_type>>;
+
+    journaled_batch(B& batch, journal_type& journal) noexcept: batch_{batch}, journal_{journal} { }
+    journaled_batch(journaled_batch const&) = delete;
+    journaled_batch& operator = (journaled_batch const&) = delete;
+
+    size_type size() const noexcept { return batch_.size(); }
+    value_type& operator [] (sequence n) { return batch_[n]; }
+    auto take(sequence n) { return batch_.take(n); }
+    void fetched() { batch_.fetched(); }
+    template<typename S> void fetched(S const& spans) { batch_.fetched(spans); }
+
+
+    sequence try_fetch() {
+      sequence const n = batch_.try_fetch();
+      if(!!n && n.value() >= journal_.next_sequence() && !journal_.append(batch_[n]))
+        return sequence{};
+      return n;
+    }
+
+
+    // Grabs every published message, the ones not journaled yet are appended.
+    // If appending fails only the journaled front of the messages is returned
+    auto try_fetch_all() {
+      auto spans = batch_.try_fetch_all();
+      if(spans.empty())
+        return spans;
+      // Consumer cursor stays at the first grabbed message until fetched(spans)
+      size_type const first = batch_.try_fetch().value();
+      size_type skip = journal_.next_sequence() - first;
+      if(!append_from(spans.head, skip) || !append_from(spans.tail, skip))
+        truncate(spans, journal_.next_sequence() - first);
+      return spans;
+    }
+
+
+  private:
+
+    B& batch_;
+    journal_type& journal_;
+
+
+    // Appends span except its first skip messages, which are in the journal already
+    template<typename S>
+    bool append_from(S const& span, size_type& skip) noexcept {
+      if(skip >= span.size()) {
+        skip -= span.size();
+        return true;
+      }
+      size_type const from = skip > 0 ? skip : 0;
+      skip = 0;
+      return journal_.append(span.data() + from, span.size() - from);
+    }
+
+
+    // Leaves the first count messages of spans
+    template<typename S>
+    static void truncate(S& spans, size_type count) noexcept {
+      using span = std::decay_t<decltype(spans.head)>;
+      if(count < 0)
+        count = 0;
+      if(count <= spans.head.size()) {
+        spans.head = span{spans.head.begin(), spans.head.begin() + count};
+        spans.tail = span{};
+      } else if(count - spans.head.size() < spans.tail.size())
+        spans.tail = span{spans.tail.begin(), spans.tail.begin() + (count - spans.head.size())};
+    }
+  }; // journaled_batch
+
+
+  // Wraps handler of activity, every message goes to the journal before the handler sees it:
+  //   target.run(theater::journaled(journal, [](auto& batch) { ... }));
+  template<typename T, typename H>
+  auto journaled(journal_writer<T>& journal, H handler) {
+    return [&journal, handler](auto& batch) {
+      journaled_batch<std::decay_t<decltype(batch)>> tapped{batch, journal};
+      handler(tapped);
+    };
+  }
+
+
+  // Messages of one mapped segment handed to the replay handler with the
+  // interface of queue_batch. They are contiguous and never wrap, so
+  // try_fetch_all() returns all of them in the head span
+  template<typename T>
+  struct journal_batch {
+
+    using size_type = sequence::value_type;
+    using value_type = T;
+    using span = batch_span<T>;
+    using spans = batch_spans<T>;
+
+    journal_batch(T* messages, size_type first, size_type count) noexcept:
+      messages_{messages}, first_{first}, last_{first + count}, consumer_{first} { }
+    journal_batch(journal_batch const&) = delete;
+    journal_batch& operator = (journal_batch const&) = delete;
+
+    size_type size() const noexcept { return last_ - consumer_; }
+    T& operator [] (sequence n) noexcept { return messages_[n.value() - first_]; }
+    T take(sequence n) noexcept { return messages_[n.value() - first_]; }
+    void fetched() noexcept { ++consumer_; }
+    void fetched(spans const& s) noexcept { consumer_ += s.size(); }
+
+
+    sequence try_fetch() const noexcept {
+      return consumer_ != last_ ? sequence{consumer_} : sequence{};
+    }
+
+
+    spans try_fetch_all() noexcept {
+      return spans{span{messages_ + (consumer_ - first_), messages_ + (last_ - first_)}, span{}};
+    }
+
+
+  private:
+
+    T* messages_;
+    size_type first_;
+    size_type last_;
+    size_type consumer_;
+  }; // journal_batch
+
+
+  // Feeds a journal back through a batch handler. Segments are mapped
+  // privately with read-ahead, handler reads messages in place and may
+  // change them without touching the files
+  template<typename T>
+  struct journal_reader {
+
+    using size_type = sequence::value_type;
+    using value_type = T;
+    using batch = journal_batch<T>;
+
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Messages are stored as bytes, they should be trivially copyable");
+
+
+    journal_reader() = default;
+    explicit journal_reader(std::string prefix): prefix_{std::move(prefix)} { }
+    void open(std::string prefix) { prefix_ = std::move(prefix); }
+
+
+    // Calls handler until every journaled message is fetched, returns number
+    // of messages replayed or -1 if a segment is damaged
+    template<typename H>
+    size_type replay(H&& handler) {
+      size_type replayed = 0;
+      for(size_type index = 0; ; ++index) {
+        std::string const path = detail::segment_path(prefix_, index);
+        int const fd = ::open(path.c_str(), O_RDONLY);
+        if(fd == -1)
+          return replayed;
+        size_type const n = replay_segment(fd, handler);
+        ::close(fd);
+        if(n < 0)
+          return -1;
+        replayed += n;
+      }
+    }
+
+
+  private:
+
+    std::string prefix_;
+
+
+    template<typename H>
+    size_type replay_segment(int fd, H& handler) {
+      struct stat st;
+      if(::fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(detail::journal_header))
+        return -1;
+      std::size_t const size = std::size_t(st.st_size);
+      void* const data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_POPULATE, fd, 0);
+      if(data == MAP_FAILED)
+        return -1;
+      ::madvise(data, size, MADV_SEQUENTIAL);
+      auto* const header = std::launder(static_cast<detail::journal_header*>(data));
+      size_type const count = header->count.load(std::memory_order_acquire);
+      if(header->magic != detail::journal_header::expected_magic
+         || header->element_size != sizeof(T)
+         || count < 0 || count > header->capacity
+         || sizeof(detail::journal_header) + sizeof(T) * std::size_t(header->capacity) > size) {
+        ::munmap(data, size);
+        return -1;
+      }
+      batch batch{reinterpret_cast<T*>(header + 1), header->first_sequence, count};
+      // A handler that stops fetching ends the replay of the segment
+      for(size_type left = batch.size(); left != 0; ) {
+        handler(batch);
+        if(batch.size() == left)
+          break;
+        left = batch.size();
+      }
+      ::munmap(data, size);
+      return count - batch.size();
+    }
+  }; // journal_reader
+
+
+} // theater
@@ -0,0 +1,287 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <chrono>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <utility>
+
+#include "sequence.hpp"
+#include "ring_cursor.hpp"
+#include "numa.hpp"
+#include "slot_layout.hpp"
+#include "wait_strategy.hpp"
+
+
+namespace theater {
+
+
+  // Bounded queue for many producers and many consumers. Every slot keeps a
+  // sequence word: n means the slot is free for producer of n, n + 1 means
+  // the element n is published, consumer returns it by setting n + capacity.
+  // W is how producers wait for room and consumers in fetch() wait for elements
+  template<typename T, typename W = yield_wait>
+  struct mpmc_queue {
+
+    using size_type = sequence::value_type;
+    using value_type = T;
+    using wait_strategy = W;
+
+    static constexpr size_type cacheline = 64;
+
+    static_assert(std::is_default_constructible_v<T>,
+                  "Consumers may give up slots in any order, elements should be default constructible");
+
+
+    mpmc_queue() noexcept = default;
+    mpmc_queue(mpmc_queue const&) = delete;
+    mpmc_queue& operator = (mpmc_queue const&) = delete;
+    mpmc_queue(size_type capacity) { reserve(capacity); }
+    mpmc_queue(size_type capacity, memory_options const& options) { reserve(capacity, options); }
+    explicit operator bool () noexcept { return !!slots_; }
+    size_type capacity() const noexcept { return capacity_; }
+
+
+    mpmc_queue(mpmc_queue&& other) noexcept:
+      capacity_{other.capacity_}, index_mask_{other.index_mask_},
+      slots_{std::move(other.slots_)},
+      producer_{other.producer_.load(std::memory_order_relaxed)},
+      consumer_{other.consumer_.load(std::memory_order_relaxed)} {
+      other.capacity_ = 0;
+      other.producer_.store(0, std::memory_order_relaxed);
+      other.consumer_.store(0, std::memory_order_relaxed);
+    }
+
+
+    mpmc_queue& operator = (mpmc_queue&& other) noexcept {
+      capacity_ = other.capacity_; other.capacity_ = 0;
+      index_mask_ = other.index_mask_;
+      slots_ = std::move(other.slots_);
+      producer_.store(other.producer_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      other.producer_.store(0, std::memory_order_relaxed);
+      consumer_.store(other.consumer_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      other.consumer_.store(0, std::memory_order_relaxed);
+      return *this;
+    }
+
+
+    void reserve(size_type capacity, memory_options const& options = memory_options{}) {
+      capacity = detail::nearest_power_of_2(capacity);
+      slots_.reserve(capacity, options);
+      for(size_type n = 0; n != capacity; ++n)
+        slots_.published(n).store(n, std::memory_order_relaxed);
+      capacity_ = capacity;
+      index_mask_ = capacity - 1;
+    }
+
+
+    void reserve(size_type capacity, numa_node node) {
+      reserve(capacity);
+      bind(node);
+    }
+
+
+    bool bind(numa_node node) noexcept {
+      return !!slots_ && slots_.bind(node);
+    }
+
+
+    size_type blocks_count() const noexcept {
+      return blocks_count_.load(std::memory_order_relaxed);
+    }
+
+
+    void clear_blocks_count() noexcept {
+      blocks_count_.store(0, std::memory_order_relaxed);
+    }
+
+
+    // Number of times fetched() had to wake parked producers
+    uint64_t wakes_count() const noexcept {
+      return room_waiter_.wakes_count();
+    }
+
+
+    size_type size() const noexcept {
+      return producer_.load(std::memory_order_relaxed)
+        - consumer_.load(std::memory_order_relaxed);
+    }
+
+
+    T& operator [] (sequence n) noexcept {
+      return slots_.value(n.value() & index_mask_);
+    }
+
+
+    T const& operator [] (sequence n) const noexcept {
+      return slots_.value(n.value() & index_mask_);
+    }
+
+
+    // Constructs element of claimed slot n in place
+    template<typename... Args>
+    T& emplace(sequence n, Args&&... args) {
+      return emplace_at(&(*this)[n], std::forward<Args>(args)...);
+    }
+
+
+    // Moves fetched element n out of its slot, leaving a default value behind
+    T take(sequence n) {
+      return take_from(&(*this)[n]);
+    }
+
+
+    sequence claim() noexcept {
+
+      if(!slots_)
+        return sequence{};
+
+      sequence const p{producer_.fetch_add(1, std::memory_order_relaxed)};
+      if(slot_state(p) == p.value())
+        return p;
+
+      blocks_count_.fetch_add(1, std::memory_order_relaxed);
+
+      // Slot of p is returned by fetched() of p - capacity
+      room_waiter_.wait([&]{ return slot_state(p) == p.value(); }, p.value() - capacity_);
+
+      return p;
+    }
+
+
+    template<typename Rep, typename Period>
+    sequence claim_for(std::chrono::duration<Rep, Period> const& duration) noexcept {
+
+      if(!slots_)
+        return sequence{};
+
+      return detail::claim_free_for(producer_, blocks_count_, room_waiter_, duration,
+                                    [this](size_type n) { return slot_state(sequence{n}) == n; },
+                                    [this](size_type n) { return n - capacity_; });
+    }
+
+
+    void publish(sequence n) noexcept {
+      slots_.published(n.value() & index_mask_).store(n.value() + 1, std::memory_order_release);
+      if constexpr(W::parks)
+        message_waiter_.notify(n.value());
+    }
+
+
+    // Claims next published element for the calling consumer
+    sequence try_fetch() noexcept {
+
+      if(!slots_)
+        return sequence{};
+
+      size_type c = consumer_.load(std::memory_order_relaxed);
+
+      for(;;) {
+        size_type const state = slot_state(sequence{c});
+        if(state == c + 1) {
+          if(consumer_.compare_exchange_weak(c, c + 1, std::memory_order_relaxed))
+            return sequence{c};
+        } else if(state <= c)
+          return sequence{};
+        else
+          c = consumer_.load(std::memory_order_relaxed);
+      }
+    }
+
+
+    // Waits until the calling consumer claims a published element, with
+    // park_wait it sleeps until a producer publishes at its cursor or later
+    sequence fetch() noexcept {
+      if(!slots_)
+        return sequence{};
+      sequence n = try_fetch();
+      while(!n) {
+        size_type const c = consumer_.load(std::memory_order_relaxed);
+        message_waiter_.wait([&]{ return slot_state(sequence{c}) > c; }, c);
+        n = try_fetch();
+      }
+      return n;
+    }
+
+
+    template<typename Rep, typename Period>
+    sequence fetch_for(std::chrono::duration<Rep, Period> const& duration) noexcept {
+      using namespace std::chrono;
+      if(!slots_)
+        return sequence{};
+      auto const deadline = steady_clock::now() + duration_cast<steady_clock::duration>(duration);
+      sequence n = try_fetch();
+      while(!n) {
+        auto const left = deadline - steady_clock::now();
+        if(left.count() <= 0)
+          return sequence{};
+        size_type const c = consumer_.load(std::memory_order_relaxed);
+        message_waiter_.wait_for([&]{ return slot_state(sequence{c}) > c; },
+                                 c, left);
+        n = try_fetch();
+      }
+      return n;
+    }
+
+
+    // Returns slot of fetched element n to producers
+    void fetched(sequence n) noexcept {
+      slots_.published(n.value() & index_mask_).store(n.value() + capacity_, std::memory_order_release);
+      if constexpr(W::parks)
+        room_waiter_.notify(n.value());
+    }
+
+
+  private:
+
+    size_type capacity_{0};
+    size_type index_mask_{0};
+    split_layout::storage<T> slots_;
+    alignas (cacheline)
+      std::atomic<size_type> producer_{0};
+    alignas (cacheline)
+      std::atomic<size_type> consumer_{0};
+    alignas (cacheline)
+      std::atomic<size_type> blocks_count_{0};
+
+    // Producers park here when the ring is full, consumers wake them
+    alignas (cacheline)
+      W room_waiter_;
+
+    // Consumers park here in fetch(), producers wake them
+    alignas (cacheline)
+      W message_waiter_;
+
+
+    size_type slot_state(sequence n) const noexcept {
+      return slots_.published(n.value() & index_mask_).load(std::memory_order_acquire);
+    }
+
+  }; // mpmc_queue
+
+
+} // theater
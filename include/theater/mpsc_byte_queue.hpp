@@ -0,0 +1,283 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include <utility>
+
+#include "sequence.hpp"
+#include "ring_cursor.hpp"
+#include "numa.hpp"
+#include "ring_memory.hpp"
+#include "wait_strategy.hpp"
+
+
+namespace theater {
+
+
+  // Multiple producers single consumer ring of variable-length byte records.
+  // A producer claims a contiguous record, writes the payload in place and
+  // publishes it; a sequence is the byte position of the record header. A
+  // record that does not fit before the end of the ring is preceded by a
+  // padding record up to the end. The consumer zeroes bytes it has fetched,
+  // so a header of a record not published yet always reads as empty
+  template<typename W = yield_wait>
+  struct mpsc_byte_queue {
+
+    using size_type = sequence::value_type;
+    using wait_strategy = W;
+
+    static constexpr size_type cacheline = 64;
+    static constexpr size_type alignment = 8;
+
+
+    mpsc_byte_queue() noexcept = default;
+    mpsc_byte_queue(mpsc_byte_queue const&) = delete;
+    mpsc_byte_queue& operator = (mpsc_byte_queue const&) = delete;
+    mpsc_byte_queue(size_type capacity) { reserve(capacity); }
+    explicit operator bool () noexcept { return !!memory_; }
+    size_type capacity() const noexcept { return capacity_; }
+
+    // Largest payload, a record with padding before it still fits into the ring
+    size_type max_record_size() const noexcept {
+      return capacity_ == 0 ? 0 : capacity_ / 2 - size_type(sizeof(header));
+    }
+
+
+    // Capacity in bytes, rounded up to a power of 2
+    void reserve(size_type capacity, memory_options const& options = memory_options{}) {
+      capacity = detail::nearest_power_of_2((std::max)(capacity, size_type(cacheline)));
+      memory_ = ring_memory{std::size_t(capacity), options};
+      std::memset(memory_.data(), 0, std::size_t(capacity));
+      bytes_ = static_cast<std::byte*>(memory_.data());
+      capacity_ = capacity;
+      index_mask_ = capacity - 1;
+    }
+
+
+    void reserve(size_type capacity, numa_node node) {
+      reserve(capacity);
+      bind(node);
+    }
+
+
+    bool bind(numa_node node) noexcept {
+      return !!memory_ && bind_to_numa_node(memory_.data(), memory_.size(), node);
+    }
+
+
+    size_type blocks_count() const noexcept {
+      return blocks_count_.load(std::memory_order_relaxed);
+    }
+
+
+    void clear_blocks_count() noexcept {
+      blocks_count_.store(0, std::memory_order_relaxed);
+    }
+
+
+    // Bytes claimed and not fetched yet, including headers and padding
+    size_type size() const noexcept {
+      return producer_.load(std::memory_order_relaxed)
+        - consumer_.load(std::memory_order_relaxed);
+    }
+
+
+    // Payload of record n
+    std::byte* operator [] (sequence n) noexcept {
+      return bytes_ + (n.value() & index_mask_) + sizeof(header);
+    }
+
+
+    std::byte const* operator [] (sequence n) const noexcept {
+      return bytes_ + (n.value() & index_mask_) + sizeof(header);
+    }
+
+
+    // Payload size of record n
+    size_type record_size(sequence n) const noexcept {
+      return header_at(n.value()).size;
+    }
+
+
+    // Claims a record of size bytes, empty sequence if it exceeds max_record_size()
+    sequence claim(size_type size) noexcept {
+      return claim_record(size, [&](size_type last) {
+        room_waiter_.wait([&]{ return has_room(last); }, last - capacity_);
+        return true;
+      });
+    }
+
+
+    // Gives up before claiming, a record is never left half claimed
+    template<typename Rep, typename Period>
+    sequence claim_for(size_type size, std::chrono::duration<Rep, Period> const& duration) noexcept {
+      using namespace std::chrono;
+      auto deadline = steady_clock::time_point{};
+      // Deadline is set once, room taken by other producers does not restart it
+      return claim_record(size, [&](size_type last) {
+        if(deadline == steady_clock::time_point{})
+          deadline = steady_clock::now() + duration_cast<steady_clock::duration>(duration);
+        auto const left = deadline - steady_clock::now();
+        return left.count() > 0
+          && room_waiter_.wait_for([&]{ return has_room(last); }, last - capacity_, left);
+      });
+    }
+
+
+    void publish(sequence n) noexcept {
+      header_at(n.value()).state.store(data_record, std::memory_order_release);
+    }
+
+
+    // Next published record, padding records are skipped
+    sequence try_fetch() noexcept {
+      if(!memory_)
+        return sequence{};
+      for(;;) {
+        size_type const c = consumer_.load(std::memory_order_relaxed);
+        header const& h = header_at(c);
+        uint32_t const state = h.state.load(std::memory_order_acquire);
+        if(state == data_record)
+          return sequence{c};
+        if(state != padding_record)
+          return sequence{};
+        release(c, h.size);
+      }
+    }
+
+
+    // Zeroes record at the consumer cursor and moves past it
+    void fetched() noexcept {
+      size_type const c = consumer_.load(std::memory_order_relaxed);
+      release(c, record_bytes(header_at(c).size));
+    }
+
+
+  private:
+
+    // Zero state means the record is not published yet
+    struct header {
+      std::atomic<uint32_t> state;
+      uint32_t size;
+    }; // header
+
+    static_assert(sizeof(header) == alignment);
+
+    static constexpr uint32_t data_record = 1;
+    static constexpr uint32_t padding_record = 2;
+
+    // Read mostly
+    ring_memory memory_;
+    std::byte* bytes_{nullptr};
+    size_type capacity_{0};
+    size_type index_mask_{0};
+
+    // Written by producers
+    alignas (cacheline)
+      std::atomic<size_type> producer_{0};
+    std::atomic<size_type> consumer_cached_{0};
+    std::atomic<size_type> blocks_count_{0};
+
+    // Written by consumer, producers touch room_waiter_ only when the ring is full
+    alignas (cacheline)
+      std::atomic<size_type> consumer_{0};
+    W room_waiter_;
+
+
+    header& header_at(size_type position) const noexcept {
+      return *std::launder(reinterpret_cast<header*>(bytes_ + (position & index_mask_)));
+    }
+
+
+    static size_type record_bytes(size_type size) noexcept {
+      return (size_type(sizeof(header)) + size + alignment - 1) & ~(alignment - 1);
+    }
+
+
+    // Claims record and padding in front of it with one compare and swap,
+    // wait(last) returns false to give up
+    template<typename Wait>
+    sequence claim_record(size_type size, Wait&& wait) noexcept {
+
+      if(!memory_ || size < 0 || size > max_record_size())
+        return sequence{};
+
+      size_type const bytes = record_bytes(size);
+      bool blocked = false;
+      size_type p = producer_.load(std::memory_order_relaxed);
+
+      for(;;) {
+        size_type const offset = p & index_mask_;
+        size_type const padding = offset + bytes > capacity_ ? capacity_ - offset : 0;
+        size_type const last = p + padding + bytes;
+        if(!has_room(last)) {
+          if(!blocked) {
+            blocked = true;
+            blocks_count_.fetch_add(1, std::memory_order_relaxed);
+          }
+          if(!wait(last))
+            return sequence{};
+          p = producer_.load(std::memory_order_relaxed);
+          continue;
+        }
+        if(!producer_.compare_exchange_weak(p, last, std::memory_order_relaxed))
+          continue;
+        if(padding != 0) {
+          header& h = header_at(p);
+          h.size = uint32_t(padding);
+          h.state.store(padding_record, std::memory_order_release);
+        }
+        header_at(p + padding).size = uint32_t(size);
+        return sequence{p + padding};
+      }
+    }
+
+
+    bool has_room(size_type last) noexcept {
+      if(last - consumer_cached_.load(std::memory_order_acquire) <= capacity_)
+        return true;
+      size_type const c = consumer_.load(std::memory_order_acquire);
+      consumer_cached_.store(c, std::memory_order_release);
+      return last - c <= capacity_;
+    }
+
+
+    void release(size_type c, size_type bytes) noexcept {
+      std::memset(bytes_ + (c & index_mask_), 0, std::size_t(bytes));
+      consumer_.store(c + bytes, std::memory_order_release);
+      room_waiter_.notify(c + bytes);
+    }
+
+  }; // mpsc_byte_queue
+
+
+} // theater
@@ -27,104 +27,168 @@
 #include <cstdint>
 #include <cstring>
 #include <atomic>
-#include <thread>
 #include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
 
 #include "sequence.hpp"
+#include "ring_cursor.hpp"
+#include "slot_layout.hpp"
+#include "wait_strategy.hpp"
 
 
 namespace theater {
 
 
-  template<typename T>
+  // Cursors and waiters of mpsc_queue. The queue keeps them itself unless
+  // the layout keeps them next to the slots (L::keeps_cursors), as the
+  // shared memory region does
+  template<typename W>
+  struct mpsc_cursors {
+
+    using size_type = sequence::value_type;
+
+    static constexpr size_type cacheline = 64;
+
+    // Written by producers
+    alignas (cacheline)
+      std::atomic<size_type> producer{0};
+    std::atomic<size_type> consumer_cached{0};
+    std::atomic<size_type> blocks_count{0};
+
+    // Written by consumer, producers touch room_waiter only when the ring is full
+    alignas (cacheline)
+      std::atomic<size_type> consumer{0};
+    W room_waiter;
+
+    // Written by consumer when it sleeps in fetch(), read by producers
+    alignas (cacheline)
+      W message_waiter;
+  }; // mpsc_cursors
+
+
+  // W is how producers wait for room when the ring is full, with park_wait
+  // they sleep until the consumer frees their slot
+  template<typename T, typename L = split_layout, typename W = yield_wait>
   struct mpsc_queue {
 
     using size_type = sequence::value_type;
     using value_type = T;
+    using layout_type = L;
+    using wait_strategy = W;
 
     static constexpr size_type cacheline = 64;
+    static constexpr bool contiguous = L::contiguous;
+    static constexpr size_type fixed_capacity = L::fixed_capacity;
+    static constexpr bool bulk_copyable = contiguous
+      && (constructed_slots<T> || std::is_trivially_copyable_v<T>);
 
 
-    mpsc_queue() noexcept = default;
+    mpsc_queue() noexcept(std::is_nothrow_default_constructible_v<typename L::template storage<T>>) = default;
     mpsc_queue(mpsc_queue const&) = delete;
     mpsc_queue& operator = (mpsc_queue const&) = delete;
     mpsc_queue(size_type capacity) { reserve(capacity); }
-    explicit operator bool () noexcept { return !!pool_; }
-    size_type capacity() const noexcept { return capacity_; }
+    mpsc_queue(size_type capacity, memory_options const& options) { reserve(capacity, options); }
+    ~mpsc_queue() { destroy_pending(); }
+    explicit operator bool () noexcept { return !!slots_; }
+    size_type capacity() const noexcept { return slots_.capacity(); }
 
 
-    mpsc_queue(mpsc_queue&& other) noexcept:
-      capacity_{other.capacity_}, index_mask_{other.index_mask_},
-      pool_{std::move(other.pool_)}, published_{std::move(other.published_)},
-      producer_{other.producer_.load(std::memory_order_relaxed)},
-      consumer_{other.consumer_} {
-      other.capacity_ = 0;
-      other.producer_.store(0, std::memory_order_relaxed);
-      other.consumer_ = 0;
+    mpsc_queue(mpsc_queue&& other) noexcept: slots_{std::move(other.slots_)} {
+      if constexpr(!L::keeps_cursors)
+        take_cursors(other);
     }
 
 
     mpsc_queue& operator = (mpsc_queue&& other) noexcept {
-      capacity_ = other.capacity_; other.capacity_ = 0;
-      index_mask_ = other.index_mask_;
-      pool_ = std::move(other.pool_);
-      published_ = std::move(other.published_);
-      producer_.store(other.producer_.load(std::memory_order_relaxed), std::memory_order_relaxed);
-      other.producer_.store(0, std::memory_order_relaxed);
-      consumer_ = other.consumer_; other.consumer_ = 0;
+      if(this == &other)
+        return *this;
+      destroy_pending();
+      slots_ = std::move(other.slots_);
+      if constexpr(!L::keeps_cursors)
+        take_cursors(other);
       return *this;
     }
 
 
-    void reserve(size_type capacity) {
-      capacity = nearest_power_of_2(capacity);      
-      published_ = std::make_unique<std::atomic<size_type>[]>(capacity);
-      for(size_type n = 0; n != capacity; ++n)
-        published_[n] = 0;
-      capacity_ = capacity;
-      index_mask_ = capacity - 1;
-      pool_ = std::make_unique<T[]>(capacity);
+    // Inline layouts have fixed capacity, reserve leaves them as they are
+    void reserve(size_type capacity, memory_options const& options = memory_options{}) {
+      if constexpr(fixed_capacity == 0) {
+        destroy_pending();
+        slots_.reserve(detail::nearest_power_of_2(capacity), options);
+      }
+    }
+
+
+    void reserve(size_type capacity, numa_node node) {
+      reserve(capacity);
+      bind(node);
+    }
+
+
+    // Moves ring memory to the NUMA node, false if it stays where it is
+    bool bind(numa_node node) noexcept {
+      return !!slots_ && slots_.bind(node);
+    }
+
+
+    // Memory block of the ring, to check if huge pages or locking succeeded
+    ring_memory const& memory() const noexcept {
+      return slots_.memory();
     }
     
     
     size_type blocks_count() const noexcept {
-      return blocks_count_.load(std::memory_order_relaxed);
+      if(!slots_)
+        return 0;
+      return cursors().blocks_count.load(std::memory_order_relaxed);
     }
     
     
     void clear_blocks_count() noexcept {
-      blocks_count_.store(0, std::memory_order_relaxed);
+      if(!!slots_)
+        cursors().blocks_count.store(0, std::memory_order_relaxed);
+    }
+
+
+    // Number of times fetched() had to wake parked producers
+    uint64_t wakes_count() const noexcept {
+      if(!slots_)
+        return 0;
+      return cursors().room_waiter.wakes_count();
     }
 
 
     size_type size() const noexcept {
-      return producer_.load(std::memory_order_relaxed) - consumer_;
+      if(!slots_)
+        return 0;
+      return cursors().producer.load(std::memory_order_relaxed)
+        - cursors().consumer.load(std::memory_order_relaxed);
     }
 
 
     T& operator [] (sequence n) noexcept {
-      return pool_[n.value() & index_mask_];
+      return slots_.value(n.value() & index_mask());
     }
 
 
     T const& operator [] (sequence n) const noexcept {
-      return pool_[n.value() & index_mask_];
+      return slots_.value(n.value() & index_mask());
     }
 
 
     sequence claim() noexcept {
 
-      if(!pool_)
+      if(!slots_)
         return sequence{};
 
-      sequence const p{producer_.fetch_add(1, std::memory_order_relaxed)};
-      if(p.value() - consumer_ < capacity_)
+      sequence const p{cursors().producer.fetch_add(1, std::memory_order_relaxed)};
+      if(has_room(p.value() + 1))
         return p;
 
-      blocks_count_.fetch_add(1, std::memory_order_relaxed);
-
-      while(p.value() - consumer_ >= capacity_)
-        std::this_thread::yield();
+      cursors().blocks_count.fetch_add(1, std::memory_order_relaxed);
+      wait_for_room(p.value() + 1);
 
       return p;
     }
@@ -133,74 +197,277 @@ namespace theater {
     template<typename Rep, typename Period>
     sequence claim_for(std::chrono::duration<Rep, Period> const& duration) noexcept {
 
-      if(!pool_)
+      if(!slots_)
         return sequence{};
 
-      sequence const p{producer_.fetch_add(1, std::memory_order_relaxed)};
-
-      if(p.value() - consumer_ < capacity_)
-        return p;
+      return detail::claim_free_for(cursors().producer, cursors().blocks_count,
+                                    cursors().room_waiter, duration,
+                                    [this](size_type n) { return has_room(n + 1); },
+                                    [this](size_type n) { return n + 1 - capacity(); });
+    }
 
-      blocks_count_.fetch_add(1, std::memory_order_relaxed);
 
-      auto const started = std::chrono::steady_clock::now();
+    // Claims count contiguous slots with a single fetch_add
+    sequence_range claim_n(size_type count) noexcept {
 
-      while(p.value() - consumer_ >= capacity_) {
+      if(!slots_ || count <= 0 || count > capacity())
+        return sequence_range{};
 
-        std::this_thread::yield();
+      size_type const first = cursors().producer.fetch_add(count, std::memory_order_relaxed);
+      size_type const last = first + count;
 
-        if(std::chrono::steady_clock::now() - started >= duration)
-          return sequence{};
+      if(!has_room(last)) {
+        cursors().blocks_count.fetch_add(1, std::memory_order_relaxed);
+        wait_for_room(last);
       }
 
-      return p;
+      return sequence_range{sequence{first}, sequence{last}};
+    }
+
+
+    // Constructs element of claimed slot n in place
+    template<typename... Args>
+    T& emplace(sequence n, Args&&... args) {
+      return emplace_at(&slots_.value(n.value() & index_mask()), std::forward<Args>(args)...);
+    }
+
+
+    // Moves fetched element n out of its slot and destroys it
+    T take(sequence n) {
+      return take_from(&slots_.value(n.value() & index_mask()));
     }
 
 
     void publish(sequence n) noexcept {
-      published_[n.value() & index_mask_] = n.value() + 1;
+      slots_.published(n.value() & index_mask()) = n.value() + 1;
+      if constexpr(W::parks)
+        cursors().message_waiter.notify(n.value());
+    }
+
+
+    // Publishes [first, last)
+    void publish_range(sequence first, sequence last) noexcept {
+      for(size_type n = first.value(); n != last.value(); ++n)
+        slots_.published(n & index_mask()).store(n + 1, std::memory_order_release);
+      if constexpr(W::parks)
+        cursors().message_waiter.notify(last.value() - 1);
+    }
+
+
+    void publish_range(sequence_range range) noexcept {
+      publish_range(range.first(), range.last());
+    }
+
+
+    // Claims, copies and publishes count elements, count should not exceed capacity
+    bool push(T const* data, size_type count) noexcept {
+      auto const range = claim_n(count);
+      if(!range)
+        return false;
+      size_type const first = range.first().value() & index_mask();
+      if constexpr(bulk_copyable) {
+        size_type const head = (std::min)(count, capacity() - first);
+        copy_in(data, data + head, &slots_.value(first));
+        copy_in(data + head, data + count, &slots_.value(0));
+      } else {
+        for(size_type i = 0; i != count; ++i)
+          emplace_at(&slots_.value((first + i) & index_mask()), data[i]);
+      }
+      publish_range(range);
+      return true;
+    }
+
+
+    // Moves out up to count published elements, returns number of elements popped
+    size_type pop(T* data, size_type count) noexcept {
+      size_type const n = try_fetch_range(count).size();
+      size_type const first = cursors().consumer.load(std::memory_order_relaxed) & index_mask();
+      if constexpr(bulk_copyable) {
+        size_type const head = (std::min)(n, capacity() - first);
+        move_out(&slots_.value(first), &slots_.value(first) + head, data);
+        move_out(&slots_.value(0), &slots_.value(0) + (n - head), data + head);
+      } else {
+        for(size_type i = 0; i != n; ++i)
+          data[i] = take_from(&slots_.value((first + i) & index_mask()));
+      }
+      fetched(n);
+      return n;
     }
 
 
     sequence try_fetch() noexcept {
-      if(!pool_)
+      if(!slots_)
         return sequence{};
-      if(published_[consumer_ & index_mask_] != consumer_ + 1)
+      size_type const c = cursors().consumer.load(std::memory_order_relaxed);
+      if(!is_published(c))
         return sequence{};
-      return sequence{consumer_};
+      return sequence{c};
+    }
+    
+    
+    // Waits for the next element, with park_wait the consumer spins for a
+    // while and then sleeps until the producer of that element publishes it
+    sequence fetch() noexcept {
+      if(!slots_)
+        return sequence{};
+      size_type const c = cursors().consumer.load(std::memory_order_relaxed);
+      cursors().message_waiter.wait([&]{ return is_published(c); }, c);
+      return sequence{c};
+    }
+
+
+    template<typename Rep, typename Period>
+    sequence fetch_for(std::chrono::duration<Rep, Period> const& duration) noexcept {
+      if(!slots_)
+        return sequence{};
+      size_type const c = cursors().consumer.load(std::memory_order_relaxed);
+      if(!cursors().message_waiter.wait_for([&]{ return is_published(c); }, c, duration))
+        return sequence{};
+      return sequence{c};
+    }
+
+
+    // Scans forward for up to max published elements starting from the consumer cursor
+    sequence_range try_fetch_range(size_type max) noexcept {
+      if(!slots_)
+        return sequence_range{};
+      size_type const c = cursors().consumer.load(std::memory_order_relaxed);
+      size_type n = 0;
+      while(n != max
+            && slots_.published((c + n) & index_mask()).load(std::memory_order_acquire)
+               == c + n + 1)
+        ++n;
+      if(n == 0)
+        return sequence_range{};
+      return sequence_range{sequence{c}, sequence{c + n}};
     }
     
     
     void fetched() noexcept {
-      ++consumer_;
+      fetched(1);
+    }
+
+
+    void fetched(size_type count) noexcept {
+      size_type const c = cursors().consumer.load(std::memory_order_relaxed) + count;
+      cursors().consumer.store(c, std::memory_order_release);
+      if constexpr(W::parks) {
+        // While more elements are ready, parked producers are woken in
+        // batches of a quarter of the ring instead of one slot at a time
+        cursors().room_waiter.notify(is_published(c) ? c - (capacity() >> 2) : c);
+      }
+    }
+
+
+  protected:
+
+    // Storage of the ring, for queues that add operations of their layout
+    typename L::template storage<T>& storage() noexcept {
+      return slots_;
     }
 
 
   private:
 
-    size_type capacity_{0};
-    size_type index_mask_{0};
-    std::unique_ptr<T[]> pool_;
-    std::unique_ptr<std::atomic<sequence::value_type>[]> published_;
-    alignas (cacheline)
-      std::atomic<size_type> producer_{0};
-    alignas (cacheline)
-      size_type consumer_{0};
-    std::atomic<size_type> blocks_count_{0};
-
-
-    static uint64_t nearest_power_of_2(uint64_t n) {
-      if(n < 2)
-        return 2;
-      n--;
-      n |= n >> 1;
-      n |= n >> 2;
-      n |= n >> 4;
-      n |= n >> 8;
-      n |= n >> 16;
-      n |= n >> 32;
-      n++;
-      return n;
+    struct kept_by_storage { };
+
+    // Read mostly
+    typename L::template storage<T> slots_;
+
+    // Cursors of layouts that do not keep them in their storage
+    std::conditional_t<L::keeps_cursors, kept_by_storage, mpsc_cursors<W>> cursors_;
+
+
+    mpsc_cursors<W>& cursors() noexcept {
+      if constexpr(L::keeps_cursors) {
+        static_assert(std::is_same_v<decltype(slots_.cursors()), mpsc_cursors<W>&>,
+                      "Storage keeps cursors with another wait strategy");
+        return slots_.cursors();
+      } else
+        return cursors_;
+    }
+
+
+    mpsc_cursors<W> const& cursors() const noexcept {
+      if constexpr(L::keeps_cursors)
+        return slots_.cursors();
+      else
+        return cursors_;
+    }
+
+
+    // Cursors of the other queue move along with its slots
+    void take_cursors(mpsc_queue& other) noexcept {
+      auto const take = [](std::atomic<size_type>& to, std::atomic<size_type>& from) {
+        to.store(from.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        from.store(0, std::memory_order_relaxed);
+      };
+      take(cursors_.producer, other.cursors_.producer);
+      take(cursors_.consumer_cached, other.cursors_.consumer_cached);
+      take(cursors_.consumer, other.cursors_.consumer);
+    }
+
+
+    // Checks that slots up to last are free using the snapshot of consumer
+    // cursor, reloads the cursor only when the ring looks full
+    bool has_room(size_type last) noexcept {
+      if(last - cursors().consumer_cached.load(std::memory_order_acquire) <= capacity())
+        return true;
+      size_type const c = cursors().consumer.load(std::memory_order_acquire);
+      cursors().consumer_cached.store(c, std::memory_order_release);
+      return last - c <= capacity();
+    }
+
+
+    size_type index_mask() const noexcept {
+      return slots_.index_mask();
+    }
+
+
+    bool is_published(size_type n) const noexcept {
+      return slots_.published(n & index_mask()).load(std::memory_order_acquire) == n + 1;
+    }
+
+
+    // Slots up to last are free once the consumer reaches last - capacity,
+    // so a parked producer is woken only by fetched() that gets there
+    void wait_for_room(size_type last) noexcept {
+      cursors().room_waiter.wait([&]{ return has_room(last); }, last - capacity());
+    }
+
+
+    // Destroys published but not fetched elements of slots without default
+    // values. Trivial elements are left alone, they may outlive the queue
+    // object in a shared region
+    void destroy_pending() noexcept {
+      if constexpr(!constructed_slots<T> && !std::is_trivially_destructible_v<T>) {
+        if(!slots_)
+          return;
+        size_type c = cursors().consumer.load(std::memory_order_relaxed);
+        while(is_published(c)) {
+          std::destroy_at(&slots_.value(c & index_mask()));
+          slots_.published(c & index_mask()).store(0, std::memory_order_relaxed);
+          ++c;
+        }
+      }
+    }
+
+
+    static void copy_in(T const* first, T const* last, T* to) noexcept {
+      if constexpr(std::is_trivially_copyable_v<T>) {
+        if(first != last)
+          std::memcpy(to, first, sizeof(T) * size_t(last - first));
+      } else
+        std::copy(first, last, to);
+    }
+
+
+    static void move_out(T* first, T* last, T* to) noexcept {
+      if constexpr(std::is_trivially_copyable_v<T>) {
+        if(first != last)
+          std::memcpy(to, first, sizeof(T) * size_t(last - first));
+      } else
+        std::move(first, last, to);
     }
 
   }; // mspc_queue
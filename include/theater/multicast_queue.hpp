@@ -0,0 +1,335 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+
+#include <chrono>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+#include "sequence.hpp"
+#include "ring_cursor.hpp"
+#include "numa.hpp"
+#include "slot_layout.hpp"
+#include "wait_strategy.hpp"
+
+
+namespace theater {
+
+
+  // Ring with many producers and a fixed set of consumers that all read
+  // every element. Each consumer keeps its own cursor, a slot is reused
+  // only after the slowest consumer has passed it, so one write feeds all
+  // readers without copies. Consumers chained by sequence barriers form a
+  // pipeline over the same slots. W is how producers wait for the slowest
+  // consumer and consumers wait in fetch()
+  template<typename T, typename W = yield_wait>
+  struct multicast_queue {
+
+    using size_type = sequence::value_type;
+    using value_type = T;
+    using wait_strategy = W;
+
+    static constexpr size_type cacheline = 64;
+
+    static_assert(std::is_default_constructible_v<T>,
+                  "Readers only look at elements, slots should keep default values");
+
+
+    // Consumer with its own cursor, can be used with queue_batch. Without
+    // upstream it sees published elements, otherwise its sequence barrier is
+    // the cursor of the upstream consumer: it sees only elements upstream has
+    // already fetched. V is T const for readers and T for pipeline stages
+    // that change elements in place before handing them on
+    template<typename V>
+    struct basic_reader {
+
+      using size_type = sequence::value_type;
+      using value_type = V;
+
+      static constexpr bool contiguous = true;
+
+      basic_reader(multicast_queue& queue, size_type index,
+                   std::atomic<size_type> const* upstream = nullptr) noexcept:
+        queue_{&queue}, cursor_{&queue.cursors_[index].value}, upstream_{upstream} { }
+
+      size_type capacity() const noexcept { return queue_->capacity_; }
+      V& operator [] (sequence n) const noexcept { return (*queue_)[n]; }
+
+
+      size_type size() const noexcept {
+        std::atomic<size_type> const& last = upstream_ ? *upstream_ : queue_->producer_;
+        return last.load(std::memory_order_relaxed) - cursor_->load(std::memory_order_relaxed);
+      }
+
+
+      sequence try_fetch() noexcept {
+        size_type const c = cursor_->load(std::memory_order_relaxed);
+        if(!available(c))
+          return sequence{};
+        return sequence{c};
+      }
+
+
+      sequence fetch() noexcept {
+        size_type const c = cursor_->load(std::memory_order_relaxed);
+        queue_->message_waiter_.wait([&]{ return available(c); }, c);
+        return sequence{c};
+      }
+
+
+      template<typename Rep, typename Period>
+      sequence fetch_for(std::chrono::duration<Rep, Period> const& duration) noexcept {
+        size_type const c = cursor_->load(std::memory_order_relaxed);
+        if(!queue_->message_waiter_.wait_for([&]{ return available(c); }, c, duration))
+          return sequence{};
+        return sequence{c};
+      }
+
+
+      sequence_range try_fetch_range(size_type max) noexcept {
+        size_type const c = cursor_->load(std::memory_order_relaxed);
+        size_type n = 0;
+        if(upstream_) {
+          upstream_cached_ = upstream_->load(std::memory_order_acquire);
+          n = (std::min)(max, upstream_cached_ - c);
+        } else
+          while(n != max && queue_->is_published(c + n))
+            ++n;
+        if(n == 0)
+          return sequence_range{};
+        return sequence_range{sequence{c}, sequence{c + n}};
+      }
+
+
+      void fetched() noexcept {
+        fetched(1);
+      }
+
+
+      // Wakes producers waiting for this consumer, they recheck the slowest
+      // one, and downstream stages waiting for element c - 1
+      void fetched(size_type count) noexcept {
+        size_type const c = cursor_->load(std::memory_order_relaxed) + count;
+        cursor_->store(c, std::memory_order_release);
+        queue_->room_waiter_.notify(c);
+        if(queue_->pipelined_)
+          queue_->message_waiter_.notify(c - 1);
+      }
+
+
+    private:
+
+      multicast_queue* queue_;
+      std::atomic<size_type>* cursor_;
+      std::atomic<size_type> const* upstream_;
+      size_type upstream_cached_{0};
+
+
+      bool available(size_type c) noexcept {
+        if(!upstream_)
+          return queue_->is_published(c);
+        if(c < upstream_cached_)
+          return true;
+        upstream_cached_ = upstream_->load(std::memory_order_acquire);
+        return c < upstream_cached_;
+      }
+    }; // basic_reader
+
+
+    using reader = basic_reader<T const>;
+    using stage = basic_reader<T>;
+
+
+    multicast_queue() noexcept = default;
+    multicast_queue(multicast_queue const&) = delete;
+    multicast_queue& operator = (multicast_queue const&) = delete;
+    explicit operator bool () noexcept { return !!slots_; }
+    size_type capacity() const noexcept { return capacity_; }
+    size_type consumers_count() const noexcept { return consumers_count_; }
+
+
+    multicast_queue(size_type capacity, size_type consumers_count) {
+      reserve(capacity, consumers_count);
+    }
+
+
+    void reserve(size_type capacity, size_type consumers_count,
+                 memory_options const& options = memory_options{}) {
+      capacity = detail::nearest_power_of_2(capacity);
+      slots_.reserve(capacity, options);
+      cursors_ = std::make_unique<cursor[]>(std::size_t(consumers_count));
+      consumers_count_ = consumers_count;
+      capacity_ = capacity;
+      index_mask_ = capacity - 1;
+    }
+
+
+    void reserve(size_type capacity, size_type consumers_count, numa_node node) {
+      reserve(capacity, consumers_count);
+      bind(node);
+    }
+
+
+    bool bind(numa_node node) noexcept {
+      return !!slots_ && slots_.bind(node);
+    }
+
+
+    // Reader with the index in [0, consumers_count)
+    reader subscribe(size_type index) noexcept {
+      return reader{*this, index};
+    }
+
+
+    // First pipeline stage, changes published elements in place
+    stage subscribe_stage(size_type index) noexcept {
+      return stage{*this, index};
+    }
+
+
+    // Pipeline stage that processes only elements stage upstream has fetched,
+    // stages are subscribed before consumers start
+    stage subscribe_stage(size_type index, size_type upstream) noexcept {
+      pipelined_ = true;
+      return stage{*this, index, &cursors_[upstream].value};
+    }
+
+
+    size_type blocks_count() const noexcept {
+      return blocks_count_.load(std::memory_order_relaxed);
+    }
+
+
+    void clear_blocks_count() noexcept {
+      blocks_count_.store(0, std::memory_order_relaxed);
+    }
+
+
+    T& operator [] (sequence n) noexcept {
+      return slots_.value(n.value() & index_mask_);
+    }
+
+
+    T const& operator [] (sequence n) const noexcept {
+      return slots_.value(n.value() & index_mask_);
+    }
+
+
+    sequence claim() noexcept {
+
+      if(!slots_ || consumers_count_ == 0)
+        return sequence{};
+
+      size_type const last = producer_.fetch_add(1, std::memory_order_relaxed) + 1;
+      if(!has_room(last)) {
+        blocks_count_.fetch_add(1, std::memory_order_relaxed);
+        room_waiter_.wait([&]{ return has_room(last); }, last - capacity_);
+      }
+
+      return sequence{last - 1};
+    }
+
+
+    template<typename Rep, typename Period>
+    sequence claim_for(std::chrono::duration<Rep, Period> const& duration) noexcept {
+
+      if(!slots_ || consumers_count_ == 0)
+        return sequence{};
+
+      return detail::claim_free_for(producer_, blocks_count_, room_waiter_, duration,
+                                    [this](size_type n) { return has_room(n + 1); },
+                                    [this](size_type n) { return n + 1 - capacity_; });
+    }
+
+
+    template<typename... Args>
+    T& emplace(sequence n, Args&&... args) {
+      return emplace_at(&(*this)[n], std::forward<Args>(args)...);
+    }
+
+
+    void publish(sequence n) noexcept {
+      slots_.published(n.value() & index_mask_).store(n.value() + 1, std::memory_order_release);
+      message_waiter_.notify(n.value());
+    }
+
+
+  private:
+
+    struct alignas (cacheline) cursor {
+      std::atomic<size_type> value{0};
+    }; // cursor
+
+    // Read mostly
+    size_type capacity_{0};
+    size_type index_mask_{0};
+    size_type consumers_count_{0};
+    bool pipelined_{false};
+    split_layout::storage<T> slots_;
+    std::unique_ptr<cursor[]> cursors_;
+
+    // Written by producers
+    alignas (cacheline)
+      std::atomic<size_type> producer_{0};
+    std::atomic<size_type> slowest_cached_{0};
+    std::atomic<size_type> blocks_count_{0};
+
+    // Written by producers when they sleep, read by readers
+    alignas (cacheline)
+      W room_waiter_;
+
+    // Written by readers when they sleep in fetch(), read by producers
+    alignas (cacheline)
+      W message_waiter_;
+
+
+    bool is_published(size_type n) const noexcept {
+      return slots_.published(n & index_mask_).load(std::memory_order_acquire) == n + 1;
+    }
+
+
+    // Checks the snapshot of the slowest cursor first, scans all cursors
+    // only when the ring looks full
+    bool has_room(size_type last) noexcept {
+      if(last - slowest_cached_.load(std::memory_order_acquire) <= capacity_)
+        return true;
+      size_type slowest = cursors_[0].value.load(std::memory_order_acquire);
+      for(size_type i = 1; i != consumers_count_; ++i) {
+        size_type const c = cursors_[i].value.load(std::memory_order_acquire);
+        if(c < slowest)
+          slowest = c;
+      }
+      slowest_cached_.store(slowest, std::memory_order_release);
+      return last - slowest <= capacity_;
+    }
+
+  }; // multicast_queue
+
+
+} // theater
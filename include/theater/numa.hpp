@@ -0,0 +1,127 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+
+#if defined(_WIN32)
+
+#include <Windows.h>
+
+#elif defined(__linux__)
+
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#else
+
+#error Unsupported OS
+
+#endif
+
+
+namespace theater {
+
+
+  // NUMA node to place queue memory on, numa_node::local() is resolved
+  // to the node of the thread that performs the binding
+  struct numa_node {
+
+    using value_type = int;
+
+    constexpr numa_node() noexcept = default;
+    numa_node(numa_node const&) noexcept = default;
+    numa_node& operator = (numa_node const&) noexcept = default;
+    explicit constexpr numa_node(value_type v): value_{v} { }
+    explicit operator bool () const noexcept { return value_ != -1; }
+    value_type value() const noexcept { return value_; }
+    bool is_local() const noexcept { return value_ == local_value; }
+    static constexpr numa_node local() noexcept { return numa_node{local_value}; }
+
+
+    static numa_node current() noexcept {
+#if defined(_WIN32)
+      PROCESSOR_NUMBER processor;
+      GetCurrentProcessorNumberEx(&processor);
+      USHORT node;
+      if(!GetNumaProcessorNodeEx(&processor, &node))
+        return numa_node{};
+      return numa_node{value_type(node)};
+#else
+      unsigned cpu = 0, node = 0;
+      if(syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+        return numa_node{};
+      return numa_node{value_type(node)};
+#endif
+    }
+
+
+    bool operator == (numa_node const& other) const noexcept {
+      return value_ == other.value_;
+    }
+
+    bool operator != (numa_node const& other) const noexcept {
+      return value_ != other.value_;
+    }
+
+  private:
+
+    static constexpr value_type local_value = -2;
+
+    value_type value_{-1};
+
+  }; // numa_node
+
+
+  // Moves whole pages of [data, data + size) to the node and prefers the node
+  // for the pages touched later. Returns false if the system can't do it or
+  // no whole page lies in the block, memory stays usable where it is
+  inline bool bind_to_numa_node(void* data, std::size_t size, numa_node node) noexcept {
+    if(node.is_local())
+      node = numa_node::current();
+    if(!node || data == nullptr || size == 0)
+      return false;
+#if defined(_WIN32)
+    return false;
+#else
+    constexpr auto bits_per_word = sizeof(unsigned long) * 8;
+    if(std::size_t(node.value()) >= bits_per_word * 16)
+      return false;
+    auto const page = std::uintptr_t(sysconf(_SC_PAGESIZE));
+    auto const first = (std::uintptr_t(data) + page - 1) & ~(page - 1);
+    auto const last = (std::uintptr_t(data) + size) & ~(page - 1);
+    if(first >= last)
+      return false;
+    unsigned long mask[16] = {};
+    mask[node.value() / bits_per_word] = 1ul << (node.value() % bits_per_word);
+    return syscall(SYS_mbind, first, last - first, MPOL_PREFERRED, mask,
+                   bits_per_word * 16, MPOL_MF_MOVE) == 0;
+#endif
+  }
+
+
+} // theater
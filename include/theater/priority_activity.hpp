@@ -0,0 +1,242 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <thread>
+#include <memory>
+#include <utility>
+#include "mpsc_queue.hpp"
+#include "wait_strategy.hpp"
+#include "numa.hpp"
+
+
+namespace theater {
+
+
+  // Activity with N mailboxes (lanes), lane 0 has the highest priority.
+  // The worker serves lanes in priority order in rounds, taking at most
+  // weight messages from every lane per round, so a control message waits
+  // for at most the weights of lower lanes instead of the whole bulk backlog,
+  // and lower lanes still get their share under a flood of urgent messages.
+  // All lanes share one notification
+  template<typename M, std::size_t N = 2, typename Q = mpsc_queue<M>, typename W = park_wait>
+  struct priority_activity {
+
+    using message_type = M;
+    using queue_type = Q;
+    using wait_strategy = W;
+    using size_type = typename Q::size_type;
+
+    static constexpr std::size_t lanes_count = N;
+    static constexpr size_type default_weight = 64;
+
+    static_assert(N > 0, "At least one lane is required");
+
+
+    // Messages of one lane the handler may take in the current round
+    struct batch {
+
+      using size_type = typename Q::size_type;
+      using value_type = typename Q::value_type;
+
+      batch(Q& queue, size_type lane) noexcept: queue_{queue}, lane_{lane} { }
+
+      size_type lane() const noexcept { return lane_; }
+      size_type budget() const noexcept { return budget_; }
+      size_type size() const noexcept { return queue_.size(); }
+      value_type& operator [] (sequence n) { return queue_[n]; }
+      value_type take(sequence n) { return queue_.take(n); }
+      void reset(size_type budget) noexcept { budget_ = budget; }
+
+
+      // Returns nothing once weight of the lane is spent in this round
+      sequence try_fetch() {
+        if(budget_ == 0)
+          return sequence{};
+        return queue_.try_fetch();
+      }
+
+
+      void fetched() {
+        queue_.fetched();
+        --budget_;
+      }
+
+
+    private:
+
+      Q& queue_;
+      size_type lane_;
+      size_type budget_{0};
+    }; // batch
+
+
+    priority_activity() noexcept {
+      for(std::size_t i = 0; i != N; ++i)
+        weights_[i] = (std::max)(default_weight >> i, size_type(1));
+    }
+
+    priority_activity(priority_activity const&) noexcept = delete;
+    priority_activity& operator = (priority_activity const&) noexcept = delete;
+    ~priority_activity() { stop(); }
+    bool active() const noexcept { return worker_.joinable(); }
+    sequence claim(size_type lane) noexcept { return lanes_[lane].claim(); }
+    message_type& at(size_type lane, sequence n) noexcept { return lanes_[lane][n]; }
+    size_type weight(size_type lane) const noexcept { return weights_[lane]; }
+    size_type blocks_count(size_type lane) const noexcept { return lanes_[lane].blocks_count(); }
+    uint64_t wakes_count() const noexcept { return new_message_.wakes_count(); }
+
+
+    // Every lane gets the same capacity
+    void reserve(size_type capacity) {
+      for(auto& each: lanes_)
+        each.reserve(capacity);
+    }
+
+
+    void reserve(size_type lane, size_type capacity) {
+      lanes_[lane].reserve(capacity);
+    }
+
+
+    // Messages taken from the lane per round, set before run()
+    void set_weight(size_type lane, size_type weight) noexcept {
+      weights_[lane] = weight > 0 ? weight : 1;
+    }
+
+
+    template<typename Rep, typename Period>
+    sequence claim_for(size_type lane, std::chrono::duration<Rep, Period> const& duration) noexcept {
+      return lanes_[lane].claim_for(duration);
+    }
+
+
+    template<typename... Args>
+    message_type& emplace(size_type lane, sequence n, Args&&... args) {
+      return lanes_[lane].emplace(n, std::forward<Args>(args)...);
+    }
+
+
+    void publish(size_type lane, sequence n) noexcept {
+      lanes_[lane].publish(n);
+      new_message_.notify();
+    }
+
+
+    bool push(size_type lane, message_type const* data, size_type count) noexcept {
+      if(!lanes_[lane].push(data, count))
+        return false;
+      new_message_.notify();
+      return true;
+    }
+
+
+    void stop() noexcept {
+      if(!worker_.joinable() || stopping_)
+        return;
+      stopping_.store(true, std::memory_order_relaxed);
+      new_message_.notify();
+      worker_.join();
+    }
+
+
+    // With numa_node::local() memory of all lanes is moved to the node the worker starts on
+    template<typename H>
+    bool run(H&& handler, numa_node node = numa_node{}) {
+
+      if(worker_.joinable() || stopping_)
+        return false;
+      for(auto& each: lanes_)
+        if(!each)
+          return false;
+
+      worker_ = std::thread{[handler, node, this]() mutable {
+
+        if(node)
+          for(auto& each: lanes_)
+            each.bind(node);
+
+        auto batches = make_batches(std::make_index_sequence<N>{});
+
+        while(!stopping_.load(std::memory_order_relaxed)) {
+          new_message_.wait([this]{
+            return stopping_.load(std::memory_order_relaxed) || any_message();
+          });
+          serve(handler, batches);
+        }
+
+        serve(handler, batches);
+        stopping_ = false;
+      }};
+
+      return true;
+    }
+
+
+  private:
+
+    std::thread worker_;
+    std::array<queue_type, N> lanes_;
+    std::array<size_type, N> weights_;
+    W new_message_;
+    std::atomic<bool> stopping_{false};
+
+
+    template<std::size_t... I>
+    std::array<batch, N> make_batches(std::index_sequence<I...>) noexcept {
+      return {batch{lanes_[I], size_type(I)}...};
+    }
+
+
+    bool any_message() noexcept {
+      for(auto& each: lanes_)
+        if(!!each.try_fetch())
+          return true;
+      return false;
+    }
+
+
+    // Runs rounds until every lane is empty or a round fetches nothing,
+    // a handler may leave messages for later as with activity
+    template<typename H>
+    void serve(H& handler, std::array<batch, N>& batches) {
+      for(bool served = true; served; ) {
+        served = false;
+        for(std::size_t i = 0; i != N; ++i) {
+          if(!lanes_[i].try_fetch())
+            continue;
+          batches[i].reset(weights_[i]);
+          handler(batches[i]);
+          served = served || batches[i].budget() != weights_[i];
+        }
+      }
+    }
+
+  }; // priority_activity
+
+
+} // theater
@@ -23,10 +23,52 @@
 #pragma once
 
 
+#include <memory>
+
 #include "sequence.hpp"
+#include "slot_layout.hpp"
 
 
 namespace theater {
+
+
+  // Contiguous run of queue slots, usable with range-for and std algorithms
+  template<typename T>
+  struct batch_span {
+
+    using value_type = T;
+    using iterator = T*;
+    using size_type = sequence::value_type;
+
+    constexpr batch_span() noexcept = default;
+    constexpr batch_span(T* first, T* last) noexcept: first_{first}, last_{last} { }
+    T* begin() const noexcept { return first_; }
+    T* end() const noexcept { return last_; }
+    T* data() const noexcept { return first_; }
+    size_type size() const noexcept { return last_ - first_; }
+    bool empty() const noexcept { return first_ == last_; }
+    T& operator [] (size_type i) const noexcept { return first_[i]; }
+
+  private:
+
+    T* first_{nullptr};
+    T* last_{nullptr};
+
+  }; // batch_span
+
+
+  // Published elements in sequence order, second part is non-empty on wrap
+  template<typename T>
+  struct batch_spans {
+
+    using size_type = sequence::value_type;
+
+    batch_span<T> head;
+    batch_span<T> tail;
+    size_type size() const noexcept { return head.size() + tail.size(); }
+    bool empty() const noexcept { return head.empty(); }
+
+  }; // batch_spans
   
   
   template<typename Q>
@@ -34,6 +76,10 @@ namespace theater {
     
     using size_type = typename Q::size_type;
     using value_type = typename Q::value_type;
+    using span = batch_span<value_type>;
+
+
+    using spans = batch_spans<value_type>;
     
     
     queue_batch() = delete;    
@@ -45,6 +91,34 @@ namespace theater {
     sequence try_fetch() { return queue_.try_fetch(); }    
     void fetched() { queue_.fetched(); }
     value_type& operator [] (sequence n) { return queue_[n]; }
+    value_type take(sequence n) { return queue_.take(n); }
+
+
+    // Slots without default values hold live elements until they are
+    // released, so the elements of s are destroyed here
+    void fetched(spans const& s) {
+      if constexpr(!constructed_slots<value_type>) {
+        std::destroy(s.head.begin(), s.head.end());
+        std::destroy(s.tail.begin(), s.tail.end());
+      }
+      queue_.fetched(s.size());
+    }
+
+
+    // Grabs every currently published element, release them with fetched(spans)
+    spans try_fetch_all() {
+      static_assert(Q::contiguous, "Queue elements should be stored contiguously");
+      auto const range = queue_.try_fetch_range(queue_.capacity());
+      if(!range)
+        return spans{};
+      size_type const capacity = queue_.capacity();
+      size_type const count = range.size();
+      size_type const offset = range.first().value() & (capacity - 1);
+      size_type const head = count < capacity - offset ? count : capacity - offset;
+      value_type* const first = &queue_[range.first()];
+      value_type* const origin = first - offset;
+      return spans{span{first, first + head}, span{origin, origin + (count - head)}};
+    }
 
     
   private:
@@ -0,0 +1,99 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <chrono>
+#include <cstdint>
+#include <atomic>
+
+#include "sequence.hpp"
+
+
+namespace theater {
+
+
+  // Helpers shared by ring queues
+  namespace detail {
+
+    // Rings have power of 2 capacities, so indexes are masked instead of divided
+    inline uint64_t nearest_power_of_2(uint64_t n) noexcept {
+      if(n < 2)
+        return 2;
+      n--;
+      n |= n >> 1;
+      n |= n >> 2;
+      n |= n >> 4;
+      n |= n >> 8;
+      n |= n >> 16;
+      n |= n >> 32;
+      n++;
+      return n;
+    }
+
+
+    // Moves cursor past p only once free(p) holds, so a producer that times
+    // out leaves no hole for the consumer to stall on. While the slot is not
+    // free the producer waits on waiter with key(p), the deadline is set
+    // once when it first blocks, blocks_count counts that
+    template<typename W, typename F, typename K, typename Rep, typename Period>
+    sequence claim_free_for(std::atomic<sequence::value_type>& cursor,
+                            std::atomic<sequence::value_type>& blocks_count, W& waiter,
+                            std::chrono::duration<Rep, Period> const& duration,
+                            F&& free, K&& key) noexcept {
+      using namespace std::chrono;
+      bool blocked = false;
+      auto deadline = steady_clock::time_point{};
+      sequence::value_type p = cursor.load(std::memory_order_relaxed);
+
+      for(;;) {
+        if(free(p)) {
+          if(cursor.compare_exchange_weak(p, p + 1, std::memory_order_relaxed))
+            return sequence{p};
+          continue;
+        }
+        // Another producer took p meanwhile
+        sequence::value_type const next = cursor.load(std::memory_order_relaxed);
+        if(next != p) {
+          p = next;
+          continue;
+        }
+        if(!blocked) {
+          blocked = true;
+          blocks_count.fetch_add(1, std::memory_order_relaxed);
+          deadline = steady_clock::now() + duration_cast<steady_clock::duration>(duration);
+        }
+        auto const left = deadline - steady_clock::now();
+        if(left.count() <= 0)
+          return sequence{};
+        waiter.wait_for([&]{
+          return free(p) || cursor.load(std::memory_order_relaxed) != p;
+        }, key(p), left);
+        p = cursor.load(std::memory_order_relaxed);
+      }
+    }
+
+  } // detail
+
+
+} // theater
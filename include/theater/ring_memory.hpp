@@ -0,0 +1,263 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <memory_resource>
+
+
+#if defined(_WIN32)
+
+#include <Windows.h>
+
+#elif defined(__linux__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#else
+
+#error Unsupported OS
+
+#endif
+
+
+namespace theater {
+
+
+  struct memory_options {
+    bool huge_pages{false};   // back with 2 MB pages, explicit or transparent
+    bool prefault{false};     // touch every page at reservation
+    bool lock{false};         // keep pages resident
+    std::pmr::memory_resource* resource{nullptr};   // arena to carve memory from
+  }; // memory_options
+
+
+  // Memory block for ring buffers. It comes from the resource if there is
+  // one, from the heap without options, otherwise pages are mapped
+  // directly, so the hot path never takes a page fault after startup
+  struct ring_memory {
+
+    static constexpr std::size_t cacheline = 64;
+    static constexpr std::size_t huge_page_size = std::size_t(2) << 20;
+
+    ring_memory() noexcept = default;
+    ring_memory(ring_memory const&) = delete;
+    ring_memory& operator = (ring_memory const&) = delete;
+    ~ring_memory() { release(); }
+    explicit operator bool () const noexcept { return data_ != nullptr; }
+    void* data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return size_; }
+    bool huge_pages() const noexcept { return huge_pages_; }
+    bool locked() const noexcept { return locked_; }
+
+
+    explicit ring_memory(std::size_t size, memory_options const& options = memory_options{}) {
+
+      if(options.resource) {
+        data_ = options.resource->allocate(size, cacheline);
+        size_ = mapped_size_ = size;
+        resource_ = options.resource;
+      } else if(!options.huge_pages && !options.prefault && !options.lock) {
+        data_ = ::operator new(size, std::align_val_t{cacheline});
+        size_ = size;
+        return;
+      } else {
+        mapped_ = true;
+        map(size, options.huge_pages);
+      }
+
+      if(options.prefault) {
+        std::size_t const page = page_size();
+        auto* bytes = static_cast<char volatile*>(data_);
+        for(std::size_t n = 0; n < mapped_size_; n += page)
+          bytes[n] = 0;
+      }
+
+      if(options.lock)
+        locked_ = lock();
+    }
+
+
+    ring_memory(ring_memory&& other) noexcept:
+      data_{other.data_}, size_{other.size_}, mapped_size_{other.mapped_size_},
+      resource_{other.resource_}, mapped_{other.mapped_},
+      huge_pages_{other.huge_pages_}, locked_{other.locked_} {
+      other.data_ = nullptr;
+      other.size_ = other.mapped_size_ = 0;
+    }
+
+
+    ring_memory& operator = (ring_memory&& other) noexcept {
+      if(this == &other)
+        return *this;
+      release();
+      data_ = other.data_; other.data_ = nullptr;
+      size_ = other.size_; other.size_ = 0;
+      mapped_size_ = other.mapped_size_; other.mapped_size_ = 0;
+      resource_ = other.resource_;
+      mapped_ = other.mapped_;
+      huge_pages_ = other.huge_pages_;
+      locked_ = other.locked_;
+      return *this;
+    }
+
+
+  private:
+
+    void* data_{nullptr};
+    std::size_t size_{0};
+    std::size_t mapped_size_{0};
+    std::pmr::memory_resource* resource_{nullptr};
+    bool mapped_{false};
+    bool huge_pages_{false};
+    bool locked_{false};
+
+
+    static std::size_t round_up(std::size_t n, std::size_t unit) noexcept {
+      return (n + unit - 1) / unit * unit;
+    }
+
+
+#if defined(_WIN32)
+
+    static std::size_t page_size() noexcept {
+      SYSTEM_INFO info;
+      GetSystemInfo(&info);
+      return info.dwPageSize;
+    }
+
+
+    // Large pages need SeLockMemoryPrivilege, fall back to regular ones
+    void map(std::size_t size, bool huge_pages) {
+      size_ = size;
+      if(huge_pages) {
+        std::size_t const large_page = GetLargePageMinimum();
+        if(large_page != 0) {
+          mapped_size_ = round_up(size, large_page);
+          data_ = VirtualAlloc(nullptr, mapped_size_,
+                               MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+          if(data_) {
+            huge_pages_ = true;
+            return;
+          }
+        }
+      }
+      mapped_size_ = round_up(size, page_size());
+      data_ = VirtualAlloc(nullptr, mapped_size_, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+      if(!data_)
+        throw std::bad_alloc{};
+    }
+
+
+    bool lock() noexcept {
+      return !!VirtualLock(data_, mapped_size_);
+    }
+
+
+    void release() noexcept {
+      if(!data_)
+        return;
+      if(locked_)
+        VirtualUnlock(data_, mapped_size_);
+      if(resource_)
+        resource_->deallocate(data_, size_, cacheline);
+      else if(!mapped_)
+        ::operator delete(data_, std::align_val_t{cacheline});
+      else
+        VirtualFree(data_, 0, MEM_RELEASE);
+      data_ = nullptr;
+    }
+
+#else
+
+    static std::size_t page_size() noexcept {
+      return std::size_t(sysconf(_SC_PAGESIZE));
+    }
+
+
+    // Explicit huge pages first, then transparent ones on a 2 MB aligned mapping
+    void map(std::size_t size, bool huge_pages) {
+      size_ = size;
+      if(huge_pages) {
+        mapped_size_ = round_up(size, huge_page_size);
+        void* const p = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(p != MAP_FAILED) {
+          data_ = p;
+          huge_pages_ = true;
+          return;
+        }
+        std::size_t const reserved = mapped_size_ + huge_page_size;
+        void* const q = mmap(nullptr, reserved, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(q == MAP_FAILED)
+          throw std::bad_alloc{};
+        auto const origin = std::uintptr_t(q);
+        auto const aligned = round_up(origin, huge_page_size);
+        if(aligned != origin)
+          munmap(q, aligned - origin);
+        std::size_t const tail = reserved - (aligned - origin) - mapped_size_;
+        if(tail != 0)
+          munmap(reinterpret_cast<void*>(aligned + mapped_size_), tail);
+        data_ = reinterpret_cast<void*>(aligned);
+        huge_pages_ = madvise(data_, mapped_size_, MADV_HUGEPAGE) == 0;
+        return;
+      }
+      mapped_size_ = round_up(size, page_size());
+      void* const p = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(p == MAP_FAILED)
+        throw std::bad_alloc{};
+      data_ = p;
+    }
+
+
+    bool lock() noexcept {
+      return mlock(data_, mapped_size_) == 0;
+    }
+
+
+    void release() noexcept {
+      if(!data_)
+        return;
+      if(locked_)
+        munlock(data_, mapped_size_);
+      if(resource_)
+        resource_->deallocate(data_, size_, cacheline);
+      else if(!mapped_)
+        ::operator delete(data_, std::align_val_t{cacheline});
+      else
+        munmap(data_, mapped_size_);
+      data_ = nullptr;
+    }
+
+#endif
+
+  }; // ring_memory
+
+
+} // theater
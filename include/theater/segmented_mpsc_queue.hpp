@@ -0,0 +1,386 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <chrono>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <utility>
+#include <mutex>
+#include <vector>
+
+#include "sequence.hpp"
+#include "ring_cursor.hpp"
+#include "numa.hpp"
+#include "slot_layout.hpp"
+#include "wait_strategy.hpp"
+
+
+namespace theater {
+
+
+  // Multiple producers single consumer queue built from fixed-size ring
+  // segments. Segments are allocated when producers run ahead of the
+  // consumer and go to the free list once the consumer has drained them,
+  // so a burst costs an allocation instead of a stall. Producers block only
+  // when max_segments segments are in use, W is how they and the consumer
+  // in fetch() wait
+  template<typename T, typename W = yield_wait>
+  struct segmented_mpsc_queue {
+
+    using size_type = sequence::value_type;
+    using value_type = T;
+    using wait_strategy = W;
+
+    static constexpr size_type cacheline = 64;
+    static constexpr size_type default_max_segments = 1024;
+
+    static_assert(std::is_default_constructible_v<T>,
+                  "Recycled segments keep their values, elements should be default constructible");
+
+
+    segmented_mpsc_queue() noexcept = default;
+    segmented_mpsc_queue(segmented_mpsc_queue const&) = delete;
+    segmented_mpsc_queue& operator = (segmented_mpsc_queue const&) = delete;
+    explicit operator bool () noexcept { return !!directory_; }
+    size_type segment_capacity() const noexcept { return index_mask_ + 1; }
+    size_type capacity() const noexcept { return capacity_; }
+
+
+    segmented_mpsc_queue(size_type segment_capacity,
+                         size_type max_segments = default_max_segments) {
+      reserve(segment_capacity, max_segments);
+    }
+
+
+    segmented_mpsc_queue(size_type segment_capacity, memory_options const& options) {
+      reserve(segment_capacity, default_max_segments, options);
+    }
+
+
+    // Segments are allocated with options, so they may come from an arena
+    void reserve(size_type segment_capacity,
+                 size_type max_segments = default_max_segments,
+                 memory_options const& options = memory_options{}) {
+      segment_capacity = detail::nearest_power_of_2(segment_capacity);
+      max_segments = detail::nearest_power_of_2(max_segments);
+      segment_shift_ = 0;
+      while((size_type(1) << segment_shift_) != segment_capacity)
+        ++segment_shift_;
+      index_mask_ = segment_capacity - 1;
+      directory_mask_ = max_segments - 1;
+      capacity_ = segment_capacity * max_segments;
+      std::lock_guard<std::mutex> lock{segments_guard_};
+      free_segments_.clear();
+      segments_.clear();
+      options_ = options;
+      directory_ = std::make_unique<std::atomic<segment*>[]>(max_segments);
+      for(size_type n = 0; n != max_segments; ++n)
+        directory_[n].store(nullptr, std::memory_order_relaxed);
+      directory_[0].store(allocate_segment(0), std::memory_order_relaxed);
+    }
+
+
+    void reserve(size_type segment_capacity, memory_options const& options) {
+      reserve(segment_capacity, default_max_segments, options);
+    }
+
+
+    void reserve(size_type segment_capacity, numa_node node) {
+      reserve(segment_capacity);
+      bind(node);
+    }
+
+
+    // Moves existing segments to the NUMA node, segments allocated later
+    // are placed there as well
+    bool bind(numa_node node) noexcept {
+      if(node.is_local())
+        node = numa_node::current();
+      std::lock_guard<std::mutex> lock{segments_guard_};
+      node_ = node;
+      bool bound = !segments_.empty();
+      for(auto const& each: segments_)
+        bound = bind_segment(*each) && bound;
+      return bound;
+    }
+
+
+    size_type blocks_count() const noexcept {
+      return blocks_count_.load(std::memory_order_relaxed);
+    }
+
+
+    void clear_blocks_count() noexcept {
+      blocks_count_.store(0, std::memory_order_relaxed);
+    }
+
+
+    // Number of times fetched() had to wake parked producers
+    uint64_t wakes_count() const noexcept {
+      return room_waiter_.wakes_count();
+    }
+
+
+    size_type segments_count() const noexcept {
+      std::lock_guard<std::mutex> lock{segments_guard_};
+      return size_type(segments_.size());
+    }
+
+
+    size_type size() const noexcept {
+      return producer_.load(std::memory_order_relaxed)
+        - consumer_.load(std::memory_order_relaxed);
+    }
+
+
+    T& operator [] (sequence n) noexcept {
+      return segment_of(n)->slots.value(n.value() & index_mask_);
+    }
+
+
+    T const& operator [] (sequence n) const noexcept {
+      return segment_of(n)->slots.value(n.value() & index_mask_);
+    }
+
+
+    // Constructs element of claimed slot n in place
+    template<typename... Args>
+    T& emplace(sequence n, Args&&... args) {
+      return emplace_at(&(*this)[n], std::forward<Args>(args)...);
+    }
+
+
+    // Moves fetched element n out of its slot, leaving a default value behind
+    T take(sequence n) {
+      return take_from(&(*this)[n]);
+    }
+
+
+    sequence claim() noexcept {
+
+      if(!directory_)
+        return sequence{};
+
+      sequence const p{producer_.fetch_add(1, std::memory_order_relaxed)};
+
+      if(!has_room(p.value())) {
+        blocks_count_.fetch_add(1, std::memory_order_relaxed);
+        room_waiter_.wait([&]{ return has_room(p.value()); }, room_key(p.value()));
+      }
+
+      ensure_segment(p);
+      return p;
+    }
+
+
+    template<typename Rep, typename Period>
+    sequence claim_for(std::chrono::duration<Rep, Period> const& duration) noexcept {
+
+      if(!directory_)
+        return sequence{};
+
+      sequence const p = detail::claim_free_for(producer_, blocks_count_, room_waiter_, duration,
+                                                [this](size_type n) { return has_room(n); },
+                                                [this](size_type n) { return room_key(n); });
+      if(!!p)
+        ensure_segment(p);
+      return p;
+    }
+
+
+    void publish(sequence n) noexcept {
+      segment_of(n)->slots.published(n.value() & index_mask_)
+        .store(n.value() + 1, std::memory_order_release);
+      if constexpr(W::parks)
+        message_waiter_.notify(n.value());
+    }
+
+
+    sequence try_fetch() noexcept {
+      if(!directory_)
+        return sequence{};
+      size_type const c = consumer_.load(std::memory_order_relaxed);
+      segment const* s = directory_[(c >> segment_shift_) & directory_mask_]
+        .load(std::memory_order_acquire);
+      if(!s || s->index != c >> segment_shift_)
+        return sequence{};
+      if(s->slots.published(c & index_mask_).load(std::memory_order_acquire) != c + 1)
+        return sequence{};
+      return sequence{c};
+    }
+
+
+    // Waits until the next element is published, with park_wait the
+    // consumer sleeps until a producer publishes it
+    sequence fetch() noexcept {
+      if(!directory_)
+        return sequence{};
+      sequence n = try_fetch();
+      while(!n) {
+        size_type const c = consumer_.load(std::memory_order_relaxed);
+        message_waiter_.wait([&]{ return !!try_fetch(); }, c);
+        n = try_fetch();
+      }
+      return n;
+    }
+
+
+    template<typename Rep, typename Period>
+    sequence fetch_for(std::chrono::duration<Rep, Period> const& duration) noexcept {
+      if(!directory_)
+        return sequence{};
+      size_type const c = consumer_.load(std::memory_order_relaxed);
+      message_waiter_.wait_for([&]{ return !!try_fetch(); }, c, duration);
+      return try_fetch();
+    }
+
+
+    // Room is counted in whole segments, so producers are woken only when
+    // the consumer leaves a segment
+    void fetched() noexcept {
+      size_type const c = consumer_.load(std::memory_order_relaxed) + 1;
+      if((c & index_mask_) != 0) {
+        consumer_.store(c, std::memory_order_release);
+        return;
+      }
+      recycle_segment((c >> segment_shift_) - 1);
+      consumer_.store(c, std::memory_order_release);
+      if constexpr(W::parks)
+        room_waiter_.notify(c);
+    }
+
+
+  private:
+
+    struct segment {
+      size_type index{-1};
+      split_layout::storage<T> slots;
+    }; // segment
+
+    size_type capacity_{0};
+    size_type index_mask_{0};
+    size_type directory_mask_{0};
+    unsigned segment_shift_{0};
+    std::unique_ptr<std::atomic<segment*>[]> directory_;
+    mutable std::mutex segments_guard_;
+    std::vector<std::unique_ptr<segment>> segments_;
+    std::vector<segment*> free_segments_;
+    numa_node node_;
+    memory_options options_;
+    alignas (cacheline)
+      std::atomic<size_type> producer_{0};
+    alignas (cacheline)
+      std::atomic<size_type> consumer_{0};
+    alignas (cacheline)
+      std::atomic<size_type> blocks_count_{0};
+
+    // Producers park here when all segments are in use, fetched() wakes them
+    alignas (cacheline)
+      W room_waiter_;
+
+    // Consumer parks here in fetch(), producers wake it
+    alignas (cacheline)
+      W message_waiter_;
+
+
+    // Capacity is counted in whole segments: the directory slot of p is free
+    // or already holds the segment of p, never a segment the consumer is in
+    bool has_room(size_type p) const noexcept {
+      size_type const c = consumer_.load(std::memory_order_acquire);
+      return (p >> segment_shift_) - (c >> segment_shift_) <= directory_mask_;
+    }
+
+
+    // Consumer position at which has_room(p) becomes true
+    size_type room_key(size_type p) const noexcept {
+      return ((p >> segment_shift_) - directory_mask_) << segment_shift_;
+    }
+
+
+    segment* segment_of(sequence n) const noexcept {
+      return directory_[(n.value() >> segment_shift_) & directory_mask_]
+        .load(std::memory_order_acquire);
+    }
+
+
+    // Links the segment of claimed p into the directory if nobody did it yet
+    void ensure_segment(sequence p) {
+      size_type const index = p.value() >> segment_shift_;
+      auto& slot = directory_[index & directory_mask_];
+      segment* expected = slot.load(std::memory_order_acquire);
+      if(expected)
+        return;
+      segment* s;
+      {
+        std::lock_guard<std::mutex> lock{segments_guard_};
+        if(free_segments_.empty())
+          s = allocate_segment(index);
+        else {
+          s = free_segments_.back();
+          free_segments_.pop_back();
+          s->index = index;
+        }
+      }
+      if(slot.compare_exchange_strong(expected, s, std::memory_order_acq_rel))
+        return;
+      std::lock_guard<std::mutex> lock{segments_guard_};
+      free_segments_.push_back(s);
+    }
+
+
+    // Consumer drained the segment, it is cleared before consumer_ moves on
+    void recycle_segment(size_type index) {
+      auto& slot = directory_[index & directory_mask_];
+      segment* s = slot.exchange(nullptr, std::memory_order_acq_rel);
+      for(size_type n = 0; n != index_mask_ + 1; ++n)
+        s->slots.published(n).store(0, std::memory_order_relaxed);
+      std::lock_guard<std::mutex> lock{segments_guard_};
+      free_segments_.push_back(s);
+    }
+
+
+    // Expects segments_guard_ to be locked
+    segment* allocate_segment(size_type index) {
+      size_type const capacity = index_mask_ + 1;
+      auto s = std::make_unique<segment>();
+      s->index = index;
+      s->slots.reserve(capacity, options_);
+      if(node_)
+        bind_segment(*s);
+      segments_.push_back(std::move(s));
+      return segments_.back().get();
+    }
+
+
+    bool bind_segment(segment& s) noexcept {
+      return s.slots.bind(node_);
+    }
+
+  }; // segmented_mpsc_queue
+
+
+} // theater
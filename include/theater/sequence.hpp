@@ -55,4 +55,29 @@ namespace theater {
   }; // sequence
 
 
+  // Half-open range [first, last) of contiguous sequences
+  struct sequence_range {
+
+    using value_type = sequence::value_type;
+
+    constexpr sequence_range() noexcept = default;
+    sequence_range(sequence_range const&) noexcept = default;
+    sequence_range& operator = (sequence_range const&) noexcept = default;
+    constexpr sequence_range(sequence first, sequence last) noexcept: first_{first}, last_{last} { }
+    explicit operator bool () const noexcept { return !!first_; }
+    sequence first() const noexcept { return first_; }
+    sequence last() const noexcept { return last_; }
+
+    value_type size() const noexcept {
+      return !first_ ? 0 : last_.value() - first_.value();
+    }
+
+  private:
+
+    sequence first_;
+    sequence last_;
+
+  }; // sequence_range
+
+
 } // theater
@@ -0,0 +1,362 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <new>
+#include <type_traits>
+
+#include "sequence.hpp"
+#include "ring_cursor.hpp"
+#include "wait_strategy.hpp"
+#include "mpsc_queue.hpp"
+
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#else
+
+#error Shared memory mailbox is supported on Linux only
+
+#endif
+
+
+namespace theater {
+
+
+  // Ring of mpsc_queue in a named shared memory region, producers and
+  // consumer may live in different processes. The region keeps only offsets,
+  // so every process maps it at its own address. Cursors and process-shared
+  // waiters live in the region too, a syscall is made only when somebody
+  // sleeps. A region kept in a file outlives restarts of every process
+  struct shared_layout {
+
+    static constexpr bool contiguous = true;
+    static constexpr sequence::value_type fixed_capacity = 0;
+    static constexpr bool keeps_cursors = true;
+    static constexpr std::size_t cacheline = 64;
+
+    template<typename T>
+    struct storage {
+
+      using size_type = sequence::value_type;
+      using cursors_type = mpsc_cursors<shared_park_wait>;
+
+      static_assert(std::is_trivially_copyable_v<T>,
+                    "Elements are shared between processes, they should be trivially copyable");
+      static_assert(alignof(T) <= cacheline, "Overaligned elements are not supported");
+
+
+      storage() noexcept = default;
+      storage(storage const&) = delete;
+      storage& operator = (storage const&) = delete;
+      ~storage() { close(); }
+      explicit operator bool () const noexcept { return region_ != nullptr; }
+      size_type capacity() const noexcept { return region_ ? region_->capacity : 0; }
+      size_type index_mask() const noexcept { return index_mask_; }
+      T& value(size_type index) noexcept { return pool_[index]; }
+      T const& value(size_type index) const noexcept { return pool_[index]; }
+      cursors_type& cursors() noexcept { return region_->cursors; }
+      cursors_type const& cursors() const noexcept { return region_->cursors; }
+
+      std::atomic<size_type>& published(size_type index) noexcept {
+        return published_[index];
+      }
+
+      std::atomic<size_type> const& published(size_type index) const noexcept {
+        return published_[index];
+      }
+
+
+      storage(storage&& other) noexcept:
+        region_{other.region_}, mapped_size_{other.mapped_size_},
+        published_{other.published_}, pool_{other.pool_}, index_mask_{other.index_mask_} {
+        other.region_ = nullptr;
+        other.mapped_size_ = 0;
+      }
+
+
+      storage& operator = (storage&& other) noexcept {
+        if(this == &other)
+          return *this;
+        close();
+        region_ = other.region_; other.region_ = nullptr;
+        mapped_size_ = other.mapped_size_; other.mapped_size_ = 0;
+        published_ = other.published_;
+        pool_ = other.pool_;
+        index_mask_ = other.index_mask_;
+        return *this;
+      }
+
+
+      bool create(char const* name, size_type capacity) noexcept {
+        close();
+        ::shm_unlink(name);
+        int const fd = ::shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if(fd == -1)
+          return false;
+        if(!initialize(fd, capacity, false)) {
+          ::shm_unlink(name);
+          return false;
+        }
+        return true;
+      }
+
+
+      bool create_file(char const* path, size_type capacity) noexcept {
+        close();
+        ::unlink(path);
+        int const fd = ::open(path, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+        if(fd == -1)
+          return false;
+        if(!initialize(fd, capacity, true)) {
+          ::unlink(path);
+          return false;
+        }
+        return true;
+      }
+
+
+      bool open(char const* name) noexcept {
+        close();
+        int const fd = ::shm_open(name, O_RDWR, 0600);
+        return fd != -1 && map(fd);
+      }
+
+
+      bool open_file(char const* path) noexcept {
+        close();
+        int const fd = ::open(path, O_RDWR | O_CLOEXEC);
+        return fd != -1 && map(fd);
+      }
+
+
+      size_type recover() noexcept {
+        if(!region_)
+          return 0;
+        cursors_type& cursors = region_->cursors;
+        size_type const c = cursors.consumer.load(std::memory_order_acquire);
+        size_type const p = cursors.producer.load(std::memory_order_relaxed);
+        size_type const last = p - c < capacity() ? p : c + capacity();
+        size_type n = c;
+        while(n != last && published_[n & index_mask_].load(std::memory_order_acquire) == n + 1)
+          ++n;
+        for(size_type m = n; m != last; ++m)
+          published_[m & index_mask_].store(0, std::memory_order_relaxed);
+        cursors.consumer_cached.store(c, std::memory_order_relaxed);
+        cursors.producer.store(n, std::memory_order_release);
+        return n - c;
+      }
+
+
+      bool sync() noexcept {
+        return region_ && ::msync(region_, mapped_size_, MS_SYNC) == 0;
+      }
+
+
+      void close() noexcept {
+        if(!region_)
+          return;
+        ::munmap(region_, mapped_size_);
+        region_ = nullptr;
+        mapped_size_ = 0;
+      }
+
+
+    private:
+
+      // Start of the shared region, followed by published words and elements
+      struct region {
+
+        static constexpr uint64_t expected_magic = 0x7468656174657232;   // "theater2"
+
+        // Read mostly
+        std::atomic<uint64_t> magic{0};
+        size_type capacity{0};
+        uint64_t element_size{0};
+
+        cursors_type cursors;
+      }; // region
+
+      static_assert(std::atomic<size_type>::is_always_lock_free,
+                    "Shared atomics should not depend on process local locks");
+      static_assert(sizeof(region) % cacheline == 0);
+
+      region* region_{nullptr};
+      std::size_t mapped_size_{0};
+      std::atomic<size_type>* published_{nullptr};
+      T* pool_{nullptr};
+      size_type index_mask_{0};
+
+
+      static std::size_t region_size(size_type capacity) noexcept {
+        std::size_t const published_size = sizeof(std::atomic<size_type>) * std::size_t(capacity);
+        std::size_t const pool_offset = sizeof(region)
+          + (published_size + cacheline - 1) / cacheline * cacheline;
+        return pool_offset + sizeof(T) * std::size_t(capacity);
+      }
+
+
+      // Takes ownership of fd
+      bool initialize(int fd, size_type capacity, bool preallocate) noexcept {
+        capacity = detail::nearest_power_of_2(capacity);
+        std::size_t const size = region_size(capacity);
+        int const resized = preallocate
+          ? ::posix_fallocate(fd, 0, off_t(size))
+          : ::ftruncate(fd, off_t(size));
+        if(resized != 0) {
+          ::close(fd);
+          return false;
+        }
+        void* const data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(data == MAP_FAILED)
+          return false;
+        region* const r = new(data) region{};
+        r->capacity = capacity;
+        r->element_size = sizeof(T);
+        auto* const published = reinterpret_cast<std::atomic<size_type>*>(
+          static_cast<char*>(data) + sizeof(region));
+        for(size_type n = 0; n != capacity; ++n)
+          new(published + n) std::atomic<size_type>{0};
+        r->magic.store(region::expected_magic, std::memory_order_release);
+        attach(r, size);
+        return true;
+      }
+
+
+      // Takes ownership of fd
+      bool map(int fd) noexcept {
+        struct stat st;
+        if(::fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(region)) {
+          ::close(fd);
+          return false;
+        }
+        std::size_t const size = std::size_t(st.st_size);
+        void* const data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(data == MAP_FAILED)
+          return false;
+        region* const r = std::launder(static_cast<region*>(data));
+        if(r->magic.load(std::memory_order_acquire) != region::expected_magic
+           || r->element_size != sizeof(T)
+           || region_size(r->capacity) != size) {
+          ::munmap(data, size);
+          return false;
+        }
+        attach(r, size);
+        return true;
+      }
+
+
+      void attach(region* r, std::size_t size) noexcept {
+        auto* const bytes = reinterpret_cast<char*>(r);
+        region_ = r;
+        mapped_size_ = size;
+        published_ = std::launder(reinterpret_cast<std::atomic<size_type>*>(bytes + sizeof(region)));
+        pool_ = reinterpret_cast<T*>(bytes + region_size(r->capacity) - sizeof(T) * std::size_t(r->capacity));
+        index_mask_ = r->capacity - 1;
+      }
+
+    }; // storage
+
+  }; // shared_layout
+
+
+  // mpsc_queue in shared memory, producers wait for room and the consumer
+  // waits for elements on process-shared futexes
+  template<typename T>
+  struct shared_mpsc_queue: mpsc_queue<T, shared_layout, shared_park_wait> {
+
+    // Creates the named region, replacing a stale one, false on failure
+    bool create(char const* name, sequence::value_type capacity) noexcept {
+      return this->storage().create(name, capacity);
+    }
+
+
+    // Creates the region in a file, replacing an existing one. The file keeps
+    // elements and cursors when every process is gone, open_file resumes them
+    bool create_file(char const* path, sequence::value_type capacity) noexcept {
+      return this->storage().create_file(path, capacity);
+    }
+
+
+    // Maps the region created by another process, false if it is missing,
+    // not initialized yet or holds elements of another size
+    bool open(char const* name) noexcept {
+      return this->storage().open(name);
+    }
+
+
+    // Maps the region kept in a file as it is: the consumer continues from
+    // the last element it marked fetched, nothing is copied or rebuilt
+    bool open_file(char const* path) noexcept {
+      return this->storage().open_file(path);
+    }
+
+
+    // Cuts claims of producers that died before publishing: producers continue
+    // from the first unpublished element, elements published after it are
+    // dropped. Call it only while no producer has the region mapped, returns
+    // the number of elements left for the consumer
+    sequence::value_type recover() noexcept {
+      return this->storage().recover();
+    }
+
+
+    // Writes the region to its file, only needed to survive a machine crash
+    bool sync() noexcept {
+      return this->storage().sync();
+    }
+
+
+    // Unmaps the region, it stays alive while other processes have it mapped
+    void close() noexcept {
+      this->storage().close();
+    }
+
+
+    // Removes the name, mapped regions stay valid
+    static bool remove(char const* name) noexcept {
+      return ::shm_unlink(name) == 0;
+    }
+
+
+    // Removes the file, mapped regions stay valid
+    static bool remove_file(char const* path) noexcept {
+      return ::unlink(path) == 0;
+    }
+
+  }; // shared_mpsc_queue
+
+
+} // theater
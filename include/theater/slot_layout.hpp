@@ -0,0 +1,454 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "sequence.hpp"
+#include "numa.hpp"
+#include "ring_memory.hpp"
+
+
+namespace theater {
+
+
+  // Slots of default constructible elements always hold a value, so they
+  // can be assigned through operator []. Slots of other elements hold one
+  // only between emplace and take
+  template<typename T>
+  constexpr bool constructed_slots = std::is_default_constructible_v<T>;
+
+
+  template<typename T, typename... Args>
+  T& emplace_at(T* slot, Args&&... args) {
+    if constexpr(!constructed_slots<T>)
+      return *new(slot) T(std::forward<Args>(args)...);
+    else if constexpr(std::is_nothrow_constructible_v<T, Args&&...>) {
+      std::destroy_at(slot);
+      return *new(slot) T(std::forward<Args>(args)...);
+    } else {
+      *slot = T(std::forward<Args>(args)...);
+      return *slot;
+    }
+  }
+
+
+  // Moves the element out and destroys it, so resources it owns are
+  // released right away instead of one lap later
+  template<typename T>
+  T take_from(T* slot) {
+    T value(std::move(*slot));
+    if constexpr(!constructed_slots<T>)
+      std::destroy_at(slot);
+    else if constexpr(std::is_nothrow_default_constructible_v<T>) {
+      std::destroy_at(slot);
+      new(slot) T();
+    } else
+      *slot = T();
+    return value;
+  }
+
+
+  // Payloads and publish sequences in two separate arrays. Payloads are
+  // contiguous, so elements can be copied and consumed in bulk
+  struct split_layout {
+
+    static constexpr bool contiguous = true;
+    static constexpr sequence::value_type fixed_capacity = 0;
+    static constexpr bool keeps_cursors = false;
+
+    template<typename T>
+    struct storage {
+
+      using size_type = sequence::value_type;
+
+      storage() noexcept = default;
+      storage(storage const&) = delete;
+      storage& operator = (storage const&) = delete;
+      ~storage() { destroy(); }
+      explicit operator bool () const noexcept { return pool_ != nullptr; }
+      size_type capacity() const noexcept { return capacity_; }
+      size_type index_mask() const noexcept { return capacity_ - 1; }
+      T& value(size_type index) noexcept { return pool_[index]; }
+      T const& value(size_type index) const noexcept { return pool_[index]; }
+      ring_memory const& memory() const noexcept { return memory_; }
+
+      std::atomic<size_type>& published(size_type index) noexcept {
+        return published_[index];
+      }
+
+      std::atomic<size_type> const& published(size_type index) const noexcept {
+        return published_[index];
+      }
+
+
+      storage(storage&& other) noexcept:
+        memory_{std::move(other.memory_)}, capacity_{other.capacity_},
+        published_{other.published_}, pool_{other.pool_} {
+        other.capacity_ = 0;
+        other.published_ = nullptr;
+        other.pool_ = nullptr;
+      }
+
+
+      storage& operator = (storage&& other) noexcept {
+        if(this == &other)
+          return *this;
+        destroy();
+        memory_ = std::move(other.memory_);
+        capacity_ = other.capacity_; other.capacity_ = 0;
+        published_ = other.published_; other.published_ = nullptr;
+        pool_ = other.pool_; other.pool_ = nullptr;
+        return *this;
+      }
+
+
+      void reserve(size_type capacity, memory_options const& options = memory_options{}) {
+        destroy();
+        std::size_t const published_size = round_up(
+            sizeof(std::atomic<size_type>) * std::size_t(capacity), pool_alignment);
+        memory_ = ring_memory{published_size + sizeof(T) * std::size_t(capacity), options};
+        auto* const bytes = static_cast<char*>(memory_.data());
+        published_ = reinterpret_cast<std::atomic<size_type>*>(bytes);
+        for(size_type n = 0; n != capacity; ++n)
+          new(published_ + n) std::atomic<size_type>{0};
+        T* const pool = reinterpret_cast<T*>(bytes + published_size);
+        if constexpr(constructed_slots<T>)
+          std::uninitialized_value_construct_n(pool, capacity);
+        pool_ = pool;
+        capacity_ = capacity;
+      }
+
+
+      bool bind(numa_node node) noexcept {
+        return bind_to_numa_node(memory_.data(), memory_.size(), node);
+      }
+
+
+    private:
+
+      static constexpr std::size_t pool_alignment =
+        alignof(T) > ring_memory::cacheline ? alignof(T) : ring_memory::cacheline;
+
+      static_assert(pool_alignment <= ring_memory::cacheline,
+                    "Overaligned elements are not supported");
+
+      ring_memory memory_;
+      size_type capacity_{0};
+      std::atomic<size_type>* published_{nullptr};
+      T* pool_{nullptr};
+
+
+      void destroy() noexcept {
+        if constexpr(constructed_slots<T>)
+          if(pool_)
+            std::destroy_n(pool_, capacity_);
+        pool_ = nullptr;
+        published_ = nullptr;
+        capacity_ = 0;
+      }
+
+
+      static std::size_t round_up(std::size_t n, std::size_t unit) noexcept {
+        return (n + unit - 1) / unit * unit;
+      }
+
+    }; // storage
+
+
+    // Payloads only, for queues that publish with a single cursor
+    template<typename T>
+    struct pool {
+
+      using size_type = sequence::value_type;
+
+      pool() noexcept = default;
+      pool(pool const&) = delete;
+      pool& operator = (pool const&) = delete;
+      ~pool() { destroy(); }
+      explicit operator bool () const noexcept { return values_ != nullptr; }
+      size_type capacity() const noexcept { return capacity_; }
+      size_type index_mask() const noexcept { return capacity_ - 1; }
+      T& value(size_type index) noexcept { return values_[index]; }
+      T const& value(size_type index) const noexcept { return values_[index]; }
+      ring_memory const& memory() const noexcept { return memory_; }
+
+
+      pool(pool&& other) noexcept:
+        memory_{std::move(other.memory_)}, capacity_{other.capacity_},
+        values_{other.values_} {
+        other.capacity_ = 0;
+        other.values_ = nullptr;
+      }
+
+
+      pool& operator = (pool&& other) noexcept {
+        if(this == &other)
+          return *this;
+        destroy();
+        memory_ = std::move(other.memory_);
+        capacity_ = other.capacity_; other.capacity_ = 0;
+        values_ = other.values_; other.values_ = nullptr;
+        return *this;
+      }
+
+
+      void reserve(size_type capacity, memory_options const& options = memory_options{}) {
+        destroy();
+        memory_ = ring_memory{sizeof(T) * std::size_t(capacity), options};
+        T* const values = static_cast<T*>(memory_.data());
+        if constexpr(constructed_slots<T>)
+          std::uninitialized_value_construct_n(values, capacity);
+        values_ = values;
+        capacity_ = capacity;
+      }
+
+
+      bool bind(numa_node node) noexcept {
+        return bind_to_numa_node(memory_.data(), memory_.size(), node);
+      }
+
+
+    private:
+
+      static_assert(alignof(T) <= ring_memory::cacheline, "Overaligned elements are not supported");
+
+      ring_memory memory_;
+      size_type capacity_{0};
+      T* values_{nullptr};
+
+
+      void destroy() noexcept {
+        if constexpr(constructed_slots<T>)
+          if(values_)
+            std::destroy_n(values_, capacity_);
+        values_ = nullptr;
+        capacity_ = 0;
+      }
+
+    }; // pool
+
+  }; // split_layout
+
+
+  // Publish sequence next to the payload in one cell, so producing or
+  // consuming touches a single cache line. Padded cells take a whole
+  // cache line each and do not share it with neighbouring producers
+  template<bool Padded = false>
+  struct cell_layout {
+
+    static constexpr bool contiguous = false;
+    static constexpr sequence::value_type fixed_capacity = 0;
+    static constexpr bool keeps_cursors = false;
+    static constexpr std::size_t cacheline = 64;
+
+    template<typename T>
+    struct storage {
+
+      using size_type = sequence::value_type;
+
+      storage() noexcept = default;
+      storage(storage const&) = delete;
+      storage& operator = (storage const&) = delete;
+      ~storage() { destroy(); }
+      explicit operator bool () const noexcept { return cells_ != nullptr; }
+      size_type capacity() const noexcept { return capacity_; }
+      size_type index_mask() const noexcept { return capacity_ - 1; }
+      T& value(size_type index) noexcept { return *cells_[index].get(); }
+      T const& value(size_type index) const noexcept { return *cells_[index].get(); }
+      ring_memory const& memory() const noexcept { return memory_; }
+
+      std::atomic<size_type>& published(size_type index) noexcept {
+        return cells_[index].published;
+      }
+
+      std::atomic<size_type> const& published(size_type index) const noexcept {
+        return cells_[index].published;
+      }
+
+
+      storage(storage&& other) noexcept:
+        memory_{std::move(other.memory_)}, capacity_{other.capacity_},
+        cells_{other.cells_} {
+        other.capacity_ = 0;
+        other.cells_ = nullptr;
+      }
+
+
+      storage& operator = (storage&& other) noexcept {
+        if(this == &other)
+          return *this;
+        destroy();
+        memory_ = std::move(other.memory_);
+        capacity_ = other.capacity_; other.capacity_ = 0;
+        cells_ = other.cells_; other.cells_ = nullptr;
+        return *this;
+      }
+
+
+      void reserve(size_type capacity, memory_options const& options = memory_options{}) {
+        destroy();
+        memory_ = ring_memory{sizeof(cell) * std::size_t(capacity), options};
+        cell* const cells = static_cast<cell*>(memory_.data());
+        std::uninitialized_value_construct_n(cells, capacity);
+        if constexpr(constructed_slots<T>)
+          for(size_type n = 0; n != capacity; ++n)
+            new(cells[n].bytes) T();
+        cells_ = cells;
+        capacity_ = capacity;
+      }
+
+
+      bool bind(numa_node node) noexcept {
+        return bind_to_numa_node(memory_.data(), memory_.size(), node);
+      }
+
+
+    private:
+
+      struct alignas(Padded ? cacheline : alignof(std::atomic<size_type>)) cell {
+        std::atomic<size_type> published{0};
+        alignas(T) unsigned char bytes[sizeof(T)];
+
+        T* get() noexcept { return std::launder(reinterpret_cast<T*>(bytes)); }
+        T const* get() const noexcept { return std::launder(reinterpret_cast<T const*>(bytes)); }
+      }; // cell
+
+      static_assert(alignof(cell) <= ring_memory::cacheline,
+                    "Overaligned elements are not supported");
+
+      ring_memory memory_;
+      size_type capacity_{0};
+      cell* cells_{nullptr};
+
+
+      void destroy() noexcept {
+        if constexpr(constructed_slots<T>)
+          if(cells_)
+            for(size_type n = 0; n != capacity_; ++n)
+              std::destroy_at(cells_[n].get());
+        cells_ = nullptr;
+        capacity_ = 0;
+      }
+
+    }; // storage
+
+  }; // cell_layout
+
+
+  // Ring inside the queue object with compile time capacity, so masks are
+  // constants and the queue needs no allocation of its own. The queue
+  // cannot be moved and reserve() leaves it as it is
+  template<sequence::value_type N>
+  struct inline_layout {
+
+    static constexpr bool contiguous = true;
+    static constexpr sequence::value_type fixed_capacity = N;
+    static constexpr bool keeps_cursors = false;
+    static constexpr std::size_t cacheline = 64;
+
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "Capacity should be a power of 2");
+
+
+    // Payloads only, for queues that publish with a single cursor
+    template<typename T>
+    struct pool {
+
+      using size_type = sequence::value_type;
+
+      pool(pool const&) = delete;
+      pool& operator = (pool const&) = delete;
+      explicit operator bool () const noexcept { return true; }
+      static constexpr size_type capacity() noexcept { return N; }
+      static constexpr size_type index_mask() noexcept { return N - 1; }
+      T& value(size_type index) noexcept { return values()[index]; }
+      T const& value(size_type index) const noexcept { return values()[index]; }
+
+
+      pool() noexcept(std::is_nothrow_default_constructible_v<T>) {
+        if constexpr(constructed_slots<T>)
+          std::uninitialized_value_construct_n(values(), N);
+      }
+
+
+      ~pool() {
+        if constexpr(constructed_slots<T>)
+          std::destroy_n(values(), N);
+      }
+
+
+      bool bind(numa_node node) noexcept {
+        return bind_to_numa_node(this, sizeof(*this), node);
+      }
+
+
+    private:
+
+      static_assert(alignof(T) <= cacheline, "Overaligned elements are not supported");
+
+      alignas (cacheline)
+        unsigned char bytes_[sizeof(T) * std::size_t(N)];
+
+      T* values() noexcept { return std::launder(reinterpret_cast<T*>(bytes_)); }
+      T const* values() const noexcept { return std::launder(reinterpret_cast<T const*>(bytes_)); }
+
+    }; // pool
+
+
+    // Publish sequences follow the payloads of the pool base, on their own cache line
+    template<typename T>
+    struct storage: pool<T> {
+
+      using size_type = sequence::value_type;
+
+      storage() noexcept(std::is_nothrow_default_constructible_v<T>) = default;
+
+      std::atomic<size_type>& published(size_type index) noexcept {
+        return published_[index];
+      }
+
+      std::atomic<size_type> const& published(size_type index) const noexcept {
+        return published_[index];
+      }
+
+      bool bind(numa_node node) noexcept {
+        return bind_to_numa_node(this, sizeof(*this), node);
+      }
+
+    private:
+
+      alignas (cacheline)
+        std::atomic<size_type> published_[N] = {};
+
+    }; // storage
+
+  }; // inline_layout
+
+
+} // theater
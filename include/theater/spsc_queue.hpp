@@ -23,69 +23,126 @@
 #pragma once
 
 
+#include <chrono>
+#include <cstdint>
+#include <atomic>
 #include <thread>
+#include <memory>
+#include <type_traits>
 
 #include "sequence.hpp"
+#include "ring_cursor.hpp"
+#include "numa.hpp"
+#include "ring_memory.hpp"
+#include "slot_layout.hpp"
+#include "wait_strategy.hpp"
 
 
 namespace theater {
   
   
-  template<typename T>
+  // Single producer single consumer ring, L is where the payloads live:
+  // split_layout allocates them, inline_layout<N> keeps them in the queue.
+  // W is how the producer waits for room and the consumer in fetch() waits
+  // for elements
+  template<typename T, typename L = split_layout, typename W = yield_wait>
   struct spsc_queue {
     
     using size_type = sequence::value_type;
     using value_type = T;
+    using layout_type = L;
+    using wait_strategy = W;
+
+    static constexpr size_type cacheline = 64;
+    static constexpr bool contiguous = true;
+    static constexpr size_type fixed_capacity = L::fixed_capacity;
     
-    spsc_queue() noexcept = default;
+    spsc_queue() noexcept(std::is_nothrow_default_constructible_v<typename L::template pool<T>>) = default;
     spsc_queue(spsc_queue const&) = delete;
     spsc_queue& operator = (spsc_queue const&) = delete;
+    spsc_queue(size_type capacity) { reserve(capacity); }
+    spsc_queue(size_type capacity, memory_options const& options) { reserve(capacity, options); }
+    ~spsc_queue() { destroy_pending(); }
     explicit operator bool () noexcept { return !!pool_; }
-    size_type blocks_count() const noexcept { return blocks_count_; }
-    void clear_blocks_count() noexcept { blocks_count_ = 0; }
-    size_type size() const noexcept { return producer_ - consumer_; }
+    size_type capacity() const noexcept { return pool_.capacity(); }
+    ring_memory const& memory() const noexcept { return pool_.memory(); }
     
     
     spsc_queue(spsc_queue&& other) noexcept:
-      capacity_{other.capacity_}, index_mask_{other.index_mask_},
-      pool_{std::move(other.pool_)}, published_{std::move(other.published_)},
-      producer_{other.producer_},
-      consumer_{other.consumer_} {
-      other.capacity_ = 0;
-      other.producer_ = 0;
-      other.consumer_ = 0;
+      pool_{std::move(other.pool_)},
+      published_{other.published_.load(std::memory_order_relaxed)},
+      claimed_{other.claimed_}, consumer_cached_{other.consumer_cached_},
+      consumer_{other.consumer_.load(std::memory_order_relaxed)},
+      published_cached_{other.published_cached_} {
+      other.reset_cursors();
     }
     
     
     spsc_queue& operator = (spsc_queue&& other) noexcept {
-      capacity_ = other.capacity_; other.capacity_ = 0;
-      index_mask_ = other.index_mask_;
+      if(this == &other)
+        return *this;
+      destroy_pending();
       pool_ = std::move(other.pool_);
-      published_ = std::move(other.published_);
-      producer_ = other.producer_; other.producer_ = 0;
-      consumer_ = other.consumer_; other.consumer_ = 0;
+      published_.store(other.published_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      claimed_ = other.claimed_;
+      consumer_cached_ = other.consumer_cached_;
+      consumer_.store(other.consumer_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      published_cached_ = other.published_cached_;
+      other.reset_cursors();
       return *this;
     }
 
 
-    void reserve(size_type capacity) {
-      capacity = nearest_power_of_2(capacity);      
-      published_ = std::make_unique<size_type[]>(capacity);
-      for(size_type n = 0; n != capacity; ++n)
-        published_[n] = 0;
-      capacity_ = capacity;
-      index_mask_ = capacity - 1;
-      pool_ = std::make_unique<T[]>(capacity);
+    // Inline layouts have fixed capacity, reserve leaves them as they are
+    void reserve(size_type capacity, memory_options const& options = memory_options{}) {
+      if constexpr(fixed_capacity == 0) {
+        destroy_pending();
+        pool_.reserve(detail::nearest_power_of_2(capacity), options);
+      }
+    }
+
+
+    void reserve(size_type capacity, numa_node node) {
+      reserve(capacity);
+      bind(node);
+    }
+
+
+    bool bind(numa_node node) noexcept {
+      return !!pool_ && pool_.bind(node);
+    }
+
+
+    size_type blocks_count() const noexcept {
+      return blocks_count_.load(std::memory_order_relaxed);
+    }
+
+
+    void clear_blocks_count() noexcept {
+      blocks_count_.store(0, std::memory_order_relaxed);
+    }
+
+
+    // Number of times fetched() had to wake the parked producer
+    uint64_t wakes_count() const noexcept {
+      return room_waiter_.wakes_count();
+    }
+
+
+    // Number of published but not yet fetched elements
+    size_type size() const noexcept {
+      return published_.load(std::memory_order_acquire)
+        - consumer_.load(std::memory_order_acquire);
     }
     
     
     T& operator [] (sequence n) noexcept {
-      return pool_[n.value() & index_mask_];
+      return pool_.value(n.value() & index_mask());
     }
 
 
     T const& operator [] (sequence n) const noexcept {
-      return pool_[n.value() & index_mask_];
+      return pool_.value(n.value() & index_mask());
     }
     
     
@@ -94,15 +151,13 @@ namespace theater {
       if(!pool_)
         return sequence{};
 
-      sequence const p{producer_++};
-      if(p.value() - consumer_ < capacity_)
-        return p;
-
-      blocks_count_++;
-
-      while(p.value() - consumer_ >= capacity_)
-        std::this_thread::yield();
+      sequence const p{claimed_};
+      if(!has_room_for(p)) {
+        blocks_count_.fetch_add(1, std::memory_order_relaxed);
+        room_waiter_.wait([&]{ return has_room_for(p); }, room_key(p));
+      }
 
+      ++claimed_;
       return p;
     }
 
@@ -113,69 +168,181 @@ namespace theater {
       if(!pool_)
         return sequence{};
 
-      sequence const p{producer_.fetch_add(1, std::memory_order_relaxed)};
-
-      if(p.value() - consumer_ < capacity_)
-        return p;
-
-      blocks_count_.fetch_add(1, std::memory_order_relaxed);
+      sequence const p{claimed_};
 
-      auto const started = std::chrono::steady_clock::now();
-
-      while(p.value() - consumer_ >= capacity_) {
-
-        std::this_thread::yield();
-
-        if(std::chrono::steady_clock::now() - started >= duration)
+      if(!has_room_for(p)) {
+        blocks_count_.fetch_add(1, std::memory_order_relaxed);
+        if(!room_waiter_.wait_for([&]{ return has_room_for(p); }, room_key(p), duration))
           return sequence{};
       }
 
+      ++claimed_;
       return p;
     }
     
     
+    // Constructs element of claimed slot n in place
+    template<typename... Args>
+    T& emplace(sequence n, Args&&... args) {
+      return emplace_at(&pool_.value(n.value() & index_mask()), std::forward<Args>(args)...);
+    }
+
+
+    // Moves fetched element n out of its slot and destroys it
+    T take(sequence n) {
+      return take_from(&pool_.value(n.value() & index_mask()));
+    }
+
+
+    // Publishes every claimed element up to and including n
     void publish(sequence n) noexcept {
-      published_[n.value() & index_mask_] = n.value() + 1;
+      published_.store(n.value() + 1, std::memory_order_release);
+      if constexpr(W::parks)
+        message_waiter_.notify(n.value());
     }
 
 
     sequence try_fetch() noexcept {
       if(!pool_)
         return sequence{};
-      if(published_[consumer_ & index_mask_] != consumer_ + 1)
+      size_type const c = consumer_.load(std::memory_order_relaxed);
+      if(c == published_cached_) {
+        published_cached_ = published_.load(std::memory_order_acquire);
+        if(c == published_cached_)
+          return sequence{};
+      }
+      return sequence{c};
+    }
+
+
+    // Waits for the next element, with park_wait the consumer spins for a
+    // while and then sleeps until the producer publishes it
+    sequence fetch() noexcept {
+      if(!pool_)
         return sequence{};
-      return sequence{consumer_};
+      size_type const c = consumer_.load(std::memory_order_relaxed);
+      message_waiter_.wait([&]{ return is_published(c); }, c);
+      return sequence{c};
+    }
+
+
+    template<typename Rep, typename Period>
+    sequence fetch_for(std::chrono::duration<Rep, Period> const& duration) noexcept {
+      if(!pool_)
+        return sequence{};
+      size_type const c = consumer_.load(std::memory_order_relaxed);
+      if(!message_waiter_.wait_for([&]{ return is_published(c); }, c, duration))
+        return sequence{};
+      return sequence{c};
+    }
+    
+    
+    sequence_range try_fetch_range(size_type max) noexcept {
+      if(!pool_ || max <= 0)
+        return sequence_range{};
+      size_type const c = consumer_.load(std::memory_order_relaxed);
+      if(c == published_cached_) {
+        published_cached_ = published_.load(std::memory_order_acquire);
+        if(c == published_cached_)
+          return sequence_range{};
+      }
+      size_type const available = published_cached_ - c;
+      return sequence_range{sequence{c}, sequence{c + (available < max ? available : max)}};
     }
     
     
     void fetched() noexcept {
-      ++consumer_;
+      fetched(1);
+    }
+
+
+    void fetched(size_type count) noexcept {
+      size_type const c = consumer_.load(std::memory_order_relaxed) + count;
+      consumer_.store(c, std::memory_order_release);
+      if constexpr(W::parks) {
+        // While more elements are ready, the parked producer is woken in
+        // batches of a quarter of the ring instead of one slot at a time
+        room_waiter_.notify(c != published_cached_ ? c - (capacity() >> 2) : c);
+      }
     }
 
 
   private:
   
-    size_type capacity_{0};
-    size_type index_mask_{0};
-    std::unique_ptr<T[]> pool_;
-    std::unique_ptr<size_type[]> published_;
-    size_type producer_{0};
-    size_type consumer_{0};
-    size_type blocks_count_{0};
-    
-    
-    static uint64_t nearest_power_of_2(uint64_t n) {
-      if(n < 2)
-        return 2;
-      n--;
-      n |= n >> 1;
-      n |= n >> 2;
-      n |= n >> 4;
-      n |= n >> 8;
-      n |= n >> 16;
-      n |= n >> 32;
-      n++;
-      return n;
+    typename L::template pool<T> pool_;
+
+    // Written by producer, cached by consumer
+    alignas (cacheline)
+      std::atomic<size_type> published_{0};
+
+    // Producer local
+    alignas (cacheline)
+      size_type claimed_{0};
+    size_type consumer_cached_{0};
+    std::atomic<size_type> blocks_count_{0};
+
+    // Written by consumer, cached by producer
+    alignas (cacheline)
+      std::atomic<size_type> consumer_{0};
+
+    // Consumer local
+    alignas (cacheline)
+      size_type published_cached_{0};
+
+    // Written by consumer, producer touches it only when the ring is full
+    alignas (cacheline)
+      W room_waiter_;
+
+    // Written by consumer when it sleeps in fetch(), read by producer
+    alignas (cacheline)
+      W message_waiter_;
+
+
+    bool has_room_for(sequence p) noexcept {
+      if(p.value() - consumer_cached_ < capacity())
+        return true;
+      consumer_cached_ = consumer_.load(std::memory_order_acquire);
+      return p.value() - consumer_cached_ < capacity();
+    }
+
+
+    // Slot p is free once the consumer reaches p + 1 - capacity
+    size_type room_key(sequence p) const noexcept {
+      return p.value() + 1 - capacity();
+    }
+
+
+    bool is_published(size_type n) noexcept {
+      if(n < published_cached_)
+        return true;
+      published_cached_ = published_.load(std::memory_order_acquire);
+      return n < published_cached_;
+    }
+
+
+    size_type index_mask() const noexcept {
+      return pool_.index_mask();
+    }
+
+
+    // Slots without default values hold only published but not fetched elements
+    void destroy_pending() noexcept {
+      if constexpr(!constructed_slots<T>) {
+        if(!pool_)
+          return;
+        size_type const published = published_.load(std::memory_order_acquire);
+        for(size_type c = consumer_.load(std::memory_order_relaxed); c != published; ++c)
+          std::destroy_at(&pool_.value(c & index_mask()));
+      }
+    }
+
+
+    void reset_cursors() noexcept {
+      published_.store(0, std::memory_order_relaxed);
+      claimed_ = 0;
+      consumer_cached_ = 0;
+      consumer_.store(0, std::memory_order_relaxed);
+      published_cached_ = 0;
     }
   }; // spsc_queue
   
@@ -0,0 +1,271 @@
+/* This file is part of theater library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+
+#include "address_wait.hpp"
+
+
+namespace theater {
+
+
+  // Hints the core that the thread is spinning
+  inline void cpu_relax() noexcept {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+  }
+
+
+  // Every strategy can wait for a progress key: the waiter is satisfied only
+  // when the notifier reaches progress >= key, so strategies that sleep wake
+  // it no earlier than that. Plain wait() and notify() do not use keys
+
+
+  // Base of wait strategies that poll the condition. Derived::idle(round)
+  // is called between polls, the clock is read once per rounds_per_clock_read
+  // rounds only
+  template<typename D>
+  struct polling_wait {
+
+    static constexpr bool parks = false;
+
+    uint64_t wakes_count() const noexcept { return 0; }
+    void notify() noexcept { }
+    void notify(int64_t) noexcept { }
+
+    template<typename P>
+    void wait(P&& ready, int64_t) noexcept { wait(ready); }
+
+    template<typename P, typename Rep, typename Period>
+    bool wait_for(P&& ready, int64_t, std::chrono::duration<Rep, Period> const& duration) noexcept {
+      return wait_for(ready, duration);
+    }
+
+
+    template<typename P>
+    void wait(P&& ready) noexcept {
+      for(unsigned round = 0; !ready(); ++round)
+        D::idle(round);
+    }
+
+
+    template<typename P, typename Rep, typename Period>
+    bool wait_for(P&& ready, std::chrono::duration<Rep, Period> const& duration) noexcept {
+      auto const deadline = std::chrono::steady_clock::now() + duration;
+      for(unsigned round = 0; !ready(); ++round) {
+        if(round % D::rounds_per_clock_read == D::rounds_per_clock_read - 1
+           && std::chrono::steady_clock::now() >= deadline)
+          return ready();
+        D::idle(round);
+      }
+      return true;
+    }
+  }; // polling_wait
+
+
+  // Burns the core, lowest latency
+  struct spin_wait: polling_wait<spin_wait> {
+    static constexpr unsigned rounds_per_clock_read = 256;
+    static void idle(unsigned) noexcept { cpu_relax(); }
+  }; // spin_wait
+
+
+  // Doubles number of pauses every round, then falls back to yield
+  struct backoff_wait: polling_wait<backoff_wait> {
+    static constexpr unsigned rounds_per_clock_read = 8;
+    static constexpr unsigned max_pause_shift = 10;
+
+    static void idle(unsigned round) noexcept {
+      if(round > max_pause_shift) {
+        std::this_thread::yield();
+        return;
+      }
+      for(unsigned i = 0; i != 1u << round; ++i)
+        cpu_relax();
+    }
+  }; // backoff_wait
+
+
+  // Gives the core to other threads between polls
+  struct yield_wait: polling_wait<yield_wait> {
+    static constexpr unsigned rounds_per_clock_read = 16;
+    static void idle(unsigned) noexcept { std::this_thread::yield(); }
+  }; // yield_wait
+
+
+  // Sleeps in the kernel until notify(). Waiters publish the lowest key they
+  // need in wanted_ before polling the condition, notifiers change the
+  // condition before checking wanted_, so a syscall is made only when
+  // somebody sleeps and the progress reached its key. Before sleeping the
+  // waiter spins for a while, the spin doubles every time it was enough and
+  // halves every time the waiter had to sleep anyway. A Shared waiter can
+  // live in memory mapped by several processes
+  template<bool Shared>
+  struct basic_park_wait {
+
+    static constexpr bool parks = true;
+    static constexpr uint32_t min_spins = 16;
+    static constexpr uint32_t max_spins = 4096;
+
+    basic_park_wait() noexcept = default;
+    basic_park_wait(basic_park_wait const&) = delete;
+    basic_park_wait& operator = (basic_park_wait const&) = delete;
+
+    uint64_t wakes_count() const noexcept {
+      return wakes_count_.load(std::memory_order_relaxed);
+    }
+
+
+    void notify() noexcept {
+      notify(nobody - 1);
+    }
+
+
+    void notify(int64_t progress) noexcept {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(wanted_.load(std::memory_order_relaxed) > progress)
+        return;
+      // Woken waiters that are still not satisfied publish their keys again
+      wanted_.store(nobody, std::memory_order_relaxed);
+      epoch_.fetch_add(1, std::memory_order_release);
+      wakes_count_.fetch_add(1, std::memory_order_relaxed);
+      wake_all();
+    }
+
+
+    template<typename P>
+    void wait(P&& ready) noexcept {
+      wait(ready, 0);
+    }
+
+
+    template<typename P>
+    void wait(P&& ready, int64_t key) noexcept {
+      if(spin(ready))
+        return;
+      while(!ready()) {
+        uint32_t const epoch = enter(key);
+        if(!ready())
+          sleep(epoch, -1);
+      }
+    }
+
+
+    template<typename P, typename Rep, typename Period>
+    bool wait_for(P&& ready, std::chrono::duration<Rep, Period> const& duration) noexcept {
+      return wait_for(ready, 0, duration);
+    }
+
+
+    template<typename P, typename Rep, typename Period>
+    bool wait_for(P&& ready, int64_t key,
+                  std::chrono::duration<Rep, Period> const& duration) noexcept {
+      using namespace std::chrono;
+      if(spin(ready))
+        return true;
+      auto const deadline = steady_clock::now() + duration;
+      for(;;) {
+        uint32_t const epoch = enter(key);
+        if(ready())
+          return true;
+        auto const left = duration_cast<nanoseconds>(deadline - steady_clock::now());
+        if(left.count() <= 0)
+          return false;
+        sleep(epoch, left.count());
+      }
+    }
+
+
+  private:
+
+    static constexpr int64_t nobody = INT64_MAX;
+
+    std::atomic<uint32_t> epoch_{0};
+    std::atomic<int64_t> wanted_{nobody};
+    std::atomic<uint64_t> wakes_count_{0};
+    std::atomic<uint32_t> spins_{min_spins};
+
+
+    template<typename P>
+    bool spin(P&& ready) noexcept {
+      uint32_t const spins = spins_.load(std::memory_order_relaxed);
+      for(uint32_t i = 0; i != spins; ++i) {
+        if(ready()) {
+          if(i != 0 && spins < max_spins)
+            spins_.store(spins * 2, std::memory_order_relaxed);
+          return true;
+        }
+        cpu_relax();
+      }
+      if(spins > min_spins)
+        spins_.store(spins / 2, std::memory_order_relaxed);
+      return false;
+    }
+
+
+    // Epoch is read before the key is published: if a notifier drops the key
+    // afterwards, it also bumps the epoch and the sleep returns at once
+    uint32_t enter(int64_t key) noexcept {
+      uint32_t const epoch = epoch_.load(std::memory_order_acquire);
+      int64_t wanted = wanted_.load(std::memory_order_relaxed);
+      while(key < wanted
+            && !wanted_.compare_exchange_weak(wanted, key, std::memory_order_relaxed));
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      return epoch;
+    }
+
+
+    // Returns when epoch_ differs from epoch, on timeout or spuriously
+    void sleep(uint32_t epoch, int64_t nanoseconds) noexcept {
+      detail::wait_on_address<Shared>(epoch_, epoch, nanoseconds);
+    }
+
+
+    void wake_all() noexcept {
+      detail::wake_by_address<Shared>(epoch_, true);
+    }
+  }; // basic_park_wait
+
+
+  using park_wait = basic_park_wait<false>;
+  using shared_park_wait = basic_park_wait<true>;
+
+
+} // theater
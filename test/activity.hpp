@@ -1,6 +1,8 @@
 #pragma once
 
 
+#include <atomic>
+#include <chrono>
 #include <thread>
 #include <string>
 #include <doctest/doctest.h>
@@ -69,3 +71,108 @@ TEST_CASE("activity::run/3") {
     target.publish(n);
   }
 }
+
+
+TEST_CASE("activity::wakes_count") {
+
+  theater::activity<int> target;
+  target.reserve(1024);
+  std::atomic<int> received{0};
+  std::atomic<bool> busy{false};
+  std::atomic<bool> released{false};
+
+  target.run([&](auto& batch) {
+    busy.store(true, std::memory_order_release);
+    while(!released.load(std::memory_order_acquire))
+      std::this_thread::yield();
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      batch.fetched();
+      received.fetch_add(1, std::memory_order_release);
+    }
+  });
+
+  auto const send = [&](int count) {
+    for(int i = 0; i != count; ++i) {
+      auto const n = target.claim();
+      target[n] = i;
+      target.publish(n);
+    }
+  };
+
+  // Idle worker is parked, the first message wakes it exactly once
+  std::this_thread::sleep_for(std::chrono::milliseconds{50});
+  REQUIRE(target.wakes_count() == 0);
+  send(1);
+  REQUIRE(target.wakes_count() == 1);
+
+  // Busy worker is not parked, a burst costs no wakes
+  while(!busy.load(std::memory_order_acquire))
+    std::this_thread::yield();
+  send(100);
+  REQUIRE(target.wakes_count() == 1);
+
+  released.store(true, std::memory_order_release);
+  while(received.load(std::memory_order_acquire) != 101)
+    std::this_thread::yield();
+
+  // Parked again once the mailbox is drained
+  std::this_thread::sleep_for(std::chrono::milliseconds{50});
+  send(1);
+  REQUIRE(target.wakes_count() == 2);
+
+  while(received.load(std::memory_order_acquire) != 102)
+    std::this_thread::yield();
+  target.stop();
+}
+
+
+TEST_CASE("activity::push") {
+
+  theater::activity<int> target;
+  target.reserve(64);
+  std::atomic<int> sum{0};
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      sum.fetch_add(batch[n], std::memory_order_relaxed);
+      batch.fetched();
+    }
+  });
+
+  int const input[] = {1, 2, 3, 4, 5, 6, 7, 8};
+  for(int i = 0; i != 10; ++i)
+    REQUIRE(target.push(input, 8));
+
+  auto const range = target.claim_n(4);
+  for(auto n = range.first().value(); n != range.last().value(); ++n)
+    target[theater::sequence{n}] = 1;
+  target.publish_range(range);
+
+  target.stop();
+  REQUIRE(sum.load() == 364);
+}
+
+
+TEST_CASE("activity::emplace") {
+
+  theater::activity<std::string> target;
+  target.reserve(16);
+  std::atomic<std::size_t> length{0};
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      std::string const text = batch.take(n);
+      length.fetch_add(text.size(), std::memory_order_relaxed);
+      batch.fetched();
+    }
+  });
+
+  for(int i = 0; i != 100; ++i) {
+    auto const n = target.claim();
+    target.emplace(n, 10, 'a');
+    target.publish(n);
+  }
+
+  target.stop();
+  REQUIRE(length.load() == 1000);
+}
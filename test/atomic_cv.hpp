@@ -77,3 +77,39 @@ TEST_CASE("atomic_cv::notify_all") {
 
   REQUIRE(all_notified);
 }
+
+
+TEST_CASE("atomic_cv::wait/timeout") {
+
+  theater::atomic_cv cv;
+
+  auto const started = std::chrono::steady_clock::now();
+  bool const notified = cv.wait(std::chrono::milliseconds{20});
+  auto const elapsed = std::chrono::steady_clock::now() - started;
+
+  REQUIRE(!notified);
+  REQUIRE(elapsed >= std::chrono::milliseconds{20});
+}
+
+
+TEST_CASE("atomic_cv::wakes_count") {
+
+  theater::atomic_cv cv;
+
+  cv.notify_one();
+  cv.notify_all();
+  REQUIRE(cv.wakes_count() == 0);
+  REQUIRE(cv.wait(std::chrono::milliseconds{1}));
+  cv.reset();
+
+  bool notified = false;
+  auto waiter = std::thread([&]{
+    notified = cv.wait(std::chrono::milliseconds{1000});
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds{50});
+  cv.notify_one();
+  waiter.join();
+
+  REQUIRE(notified);
+  REQUIRE(cv.wakes_count() == 1);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <doctest/doctest.h>
+#include <theater/fixed_mpsc_queue.hpp>
+#include <theater/fixed_spsc_queue.hpp>
+#include <theater/queue_batch.hpp>
+#include <theater/activity.hpp>
+
+
+TEST_CASE_TEMPLATE("fixed_queue::claim", Q,
+                   theater::fixed_mpsc_queue<int, 2>, theater::fixed_spsc_queue<int, 2>) {
+
+  static_assert(Q::fixed_capacity == 2);
+
+  auto target = std::make_unique<Q>();
+  REQUIRE(!!*target);
+  REQUIRE(!target->try_fetch());
+
+  auto const c1 = target->claim();
+  auto const c2 = target->claim();
+  REQUIRE(c1.value() == 0);
+  REQUIRE(c2.value() == 1);
+  (*target)[c1] = -3;
+  target->publish(c1);
+
+  REQUIRE(target->try_fetch() == c1);
+  REQUIRE((*target)[c1] == -3);
+  target->fetched();
+  target->publish(c2);
+  REQUIRE(target->try_fetch() == c2);
+  target->fetched();
+  REQUIRE(target->size() == 0);
+}
+
+
+TEST_CASE_TEMPLATE("fixed_queue::try_fetch_all", Q,
+                   theater::fixed_mpsc_queue<int, 4>, theater::fixed_spsc_queue<int, 4>) {
+
+  Q queue;
+  theater::queue_batch<Q> target(queue);
+
+  for(int i = 0; i != 6; ++i) {
+    auto const n = queue.claim();
+    queue[n] = i;
+    queue.publish(n);
+    if(i == 2) {
+      auto const s = target.try_fetch_all();
+      REQUIRE(s.size() == 3);
+      target.fetched(s);
+    }
+  }
+
+  auto const s = target.try_fetch_all();
+  REQUIRE(s.size() == 3);
+  REQUIRE(s.head.size() == 1);
+  REQUIRE(s.head[0] == 3);
+  REQUIRE(s.tail[1] == 5);
+}
+
+
+TEST_CASE_TEMPLATE("fixed_queue::activity", Q,
+                   theater::fixed_mpsc_queue<int, 8>, theater::fixed_spsc_queue<int, 8>) {
+
+  theater::activity<int, Q> target;
+  std::atomic<int> sum{0};
+
+  REQUIRE(target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      sum.fetch_add(batch[n], std::memory_order_relaxed);
+      batch.fetched();
+    }
+  }));
+
+  for(int i = 1; i != 101; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  target.stop();
+  REQUIRE(sum.load() == 5050);
+}
+
+
+TEST_CASE("fixed_queue::push") {
+
+  theater::fixed_mpsc_queue<int, 8> target;
+  int const in[] = {1, 2, 3, 4, 5, 6};
+  int out[8] = {};
+
+  REQUIRE(target.push(in, 6));
+  REQUIRE(target.pop(out, 4) == 4);
+  REQUIRE(target.push(in, 6));
+  REQUIRE(target.pop(out, 8) == 8);
+  REQUIRE(out[1] == 6);
+  REQUIRE(out[7] == 6);
+}
+
+
+TEST_CASE("fixed_queue::emplace") {
+
+  struct label {
+    explicit label(std::string text): text{std::move(text)} { }
+    std::string text;
+  };
+
+  theater::fixed_mpsc_queue<label, 2> mpsc;
+  theater::fixed_spsc_queue<label, 2> spsc;
+
+  auto const m = mpsc.claim();
+  mpsc.emplace(m, "mpsc");
+  mpsc.publish(m);
+  REQUIRE(mpsc.take(mpsc.try_fetch()).text == "mpsc");
+  mpsc.fetched();
+
+  auto const s = spsc.claim();
+  spsc.emplace(s, "spsc");
+  spsc.publish(s);
+  REQUIRE(spsc.take(spsc.try_fetch()).text == "spsc");
+  spsc.fetched();
+}
+
+
+TEST_CASE("fixed_queue::fetch") {
+
+  constexpr int count = 1000;
+  theater::fixed_mpsc_queue<int, 4, theater::park_wait> target;
+
+  auto producer = std::async(std::launch::async, [&]{
+    for(int i = 1; i <= count; ++i) {
+      auto const n = target.claim();
+      target[n] = i;
+      target.publish(n);
+    }
+  });
+
+  long long sum = 0;
+  for(int i = 0; i != count; ++i) {
+    auto const n = target.fetch();
+    sum += target[n];
+    target.fetched();
+  }
+
+  producer.get();
+  REQUIRE(sum == (long long)count * (count + 1) / 2);
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <doctest/doctest.h>
+#include <theater/activity.hpp>
+#include <theater/intrusive_mpsc_queue.hpp>
+
+
+namespace {
+
+  struct event: theater::intrusive_hook {
+    int producer{0};
+    int value{0};
+  }; // event
+
+} // namespace
+
+
+TEST_CASE("intrusive_mpsc_queue::try_fetch") {
+
+  theater::intrusive_mpsc_queue<event> target;
+  REQUIRE(!target.try_fetch());
+  REQUIRE(target.size() == 0);
+
+  event events[3];
+  for(int i = 0; i != 3; ++i) {
+    events[i].value = i;
+    target.push(&events[i]);
+  }
+
+  for(int i = 0; i != 3; ++i) {
+    auto const n = target.try_fetch();
+    REQUIRE(n == theater::sequence{i});
+    REQUIRE(target.try_fetch() == n);
+    REQUIRE(&target[n] == &events[i]);
+    target.fetched();
+  }
+  REQUIRE(!target.try_fetch());
+
+  // Fetched messages may be pushed again
+  target.push(&events[1]);
+  target.push(&events[0]);
+  REQUIRE(target.size() == 1);
+  REQUIRE(&target[target.try_fetch()] == &events[1]);
+  target.fetched();
+  REQUIRE(&target[target.try_fetch()] == &events[0]);
+  target.fetched();
+  REQUIRE(!target.try_fetch());
+}
+
+
+TEST_CASE("intrusive_mpsc_queue::push") {
+
+  constexpr int producers_count = 2;
+  constexpr int count = 10000;
+  theater::intrusive_mpsc_queue<event> target;
+  std::vector<event> pool(producers_count * count);
+
+  std::vector<std::thread> producers;
+  for(int p = 0; p != producers_count; ++p)
+    producers.emplace_back([&, p]{
+      for(int i = 0; i != count; ++i) {
+        event& e = pool[p * count + i];
+        e.producer = p;
+        e.value = i;
+        target.push(&e);
+      }
+    });
+
+  int expected[producers_count] = {};
+  bool ordered = true;
+  for(int received = 0; received != producers_count * count; ) {
+    auto const n = target.try_fetch();
+    if(!n) {
+      std::this_thread::yield();
+      continue;
+    }
+    event const& e = target[n];
+    ordered = ordered && e.value == expected[e.producer];
+    ++expected[e.producer];
+    target.fetched();
+    ++received;
+  }
+
+  for(auto& each: producers)
+    each.join();
+
+  REQUIRE(ordered);
+  REQUIRE(!target.try_fetch());
+}
+
+
+TEST_CASE("intrusive_mpsc_queue::activity") {
+
+  constexpr int count = 1000;
+  theater::activity<event, theater::intrusive_mpsc_queue<event>> target;
+  std::vector<event> pool(count);
+  std::atomic<int> handled{0};
+  std::atomic<long long> sum{0};
+
+  REQUIRE(target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      sum.fetch_add(batch[n].value, std::memory_order_relaxed);
+      batch.fetched();
+      handled.fetch_add(1, std::memory_order_release);
+    }
+  }));
+
+  for(int i = 0; i != count; ++i) {
+    pool[i].value = i + 1;
+    target.push(&pool[i]);
+  }
+
+  while(handled.load(std::memory_order_acquire) != count)
+    std::this_thread::yield();
+  target.stop();
+
+  REQUIRE(sum.load() == (long long)count * (count + 1) / 2);
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <doctest/doctest.h>
+#include <theater/journal.hpp>
+#include <theater/activity.hpp>
+
+#include <unistd.h>
+
+
+namespace {
+
+  std::string journal_prefix(char const* name) {
+    return "/tmp/theater_journal_" + std::to_string(::getpid()) + "_" + name;
+  }
+
+
+  void remove_journal(std::string const& prefix) {
+    for(int i = 0; i != 16; ++i)
+      std::remove(theater::detail::segment_path(prefix, i).c_str());
+  }
+
+} // namespace
+
+
+TEST_CASE_TEMPLATE("journal_writer::append", S, std::integral_constant<theater::journal_sync, theater::journal_sync::none>,
+                   std::integral_constant<theater::journal_sync, theater::journal_sync::async>,
+                   std::integral_constant<theater::journal_sync, theater::journal_sync::data>) {
+
+  auto const prefix = journal_prefix("append");
+  theater::journal_options options;
+  options.segment_capacity = 100;
+  options.sync = S::value;
+  options.sync_every = 16;
+
+  theater::journal_writer<int> target;
+  REQUIRE(target.open(prefix, options, 1000));
+
+  std::vector<int> input(250);
+  for(int i = 0; i != 250; ++i)
+    input[i] = i;
+  REQUIRE(target.append(input.data(), 200));
+  for(int i = 200; i != 250; ++i)
+    REQUIRE(target.append(input[i]));
+
+  REQUIRE(target.next_sequence() == 1250);
+  REQUIRE(target.segments_count() == 3);
+  target.close();
+
+  std::vector<int> replayed;
+  std::vector<theater::sequence::value_type> sequences;
+  theater::journal_reader<int> reader{prefix};
+  auto const count = reader.replay([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      replayed.push_back(batch[n]);
+      sequences.push_back(n.value());
+      batch.fetched();
+    }
+  });
+
+  remove_journal(prefix);
+
+  REQUIRE(count == 250);
+  REQUIRE(replayed == input);
+  REQUIRE(sequences.front() == 1000);
+  REQUIRE(sequences.back() == 1249);
+}
+
+
+TEST_CASE("journal_writer::open") {
+
+  auto const prefix = journal_prefix("open");
+  theater::journal_options options;
+  options.segment_capacity = 4;
+
+  theater::journal_writer<int> target;
+  REQUIRE(target.open(prefix, options));
+  for(int i = 0; i != 6; ++i)
+    REQUIRE(target.append(i));
+  target.close();
+
+  // Recorded history is never overwritten
+  REQUIRE(!target.open(prefix, options));
+  REQUIRE(!target.append(-1));
+
+  int sum = 0;
+  theater::journal_reader<int> reader{prefix};
+  auto const count = reader.replay([&](auto& batch) {
+    auto const spans = batch.try_fetch_all();
+    REQUIRE(spans.tail.empty());
+    for(auto value: spans.head)
+      sum += value;
+    batch.fetched(spans);
+  });
+
+  remove_journal(prefix);
+
+  REQUIRE(count == 6);
+  REQUIRE(sum == 15);
+}
+
+
+TEST_CASE("journaled_batch::try_fetch_all") {
+
+  auto const prefix = journal_prefix("batch");
+  theater::journal_options options;
+  options.segment_capacity = 4;
+  theater::journal_writer<int> journal;
+  REQUIRE(journal.open(prefix, options, 0));
+
+  theater::mpsc_queue<int> queue{8};
+  theater::queue_batch<theater::mpsc_queue<int>> batch{queue};
+  theater::journaled_batch<decltype(batch)> target{batch, journal};
+
+  // Nothing published, nothing journaled
+  REQUIRE(target.try_fetch_all().empty());
+  REQUIRE(journal.next_sequence() == 0);
+
+  // Second segment cannot be created
+  std::FILE* const blocker = std::fopen(theater::detail::segment_path(prefix, 1).c_str(), "w");
+  REQUIRE(blocker != nullptr);
+  std::fclose(blocker);
+
+  for(int i = 0; i != 6; ++i) {
+    auto const n = queue.claim();
+    queue[n] = i;
+    queue.publish(n);
+  }
+
+  auto const spans = target.try_fetch_all();
+  REQUIRE(spans.size() == 4);
+  REQUIRE(spans.head[3] == 3);
+  REQUIRE(journal.next_sequence() == 4);
+  REQUIRE(!journal);
+  target.fetched(spans);
+
+  // The rest stays in the queue, it is not handed out unjournaled
+  REQUIRE(!target.try_fetch());
+  REQUIRE(target.try_fetch_all().empty());
+  REQUIRE(queue.size() == 2);
+
+  remove_journal(prefix);
+}
+
+
+TEST_CASE("journal_reader::replay") {
+
+  auto const prefix = journal_prefix("replay");
+  theater::journal_options options;
+  options.segment_capacity = 64;
+
+  theater::journal_writer<int64_t> target;
+  REQUIRE(target.open(prefix, options));
+  for(int64_t i = 1; i <= 1000; ++i)
+    target.append(i);
+  target.close();
+
+  int64_t sum = 0;
+  theater::journal_reader<int64_t> reader{prefix};
+  auto const count = reader.replay([&](auto& batch) {
+    auto const spans = batch.try_fetch_all();
+    for(auto value: spans.head)
+      sum += value;
+    for(auto value: spans.tail)
+      sum += value;
+    batch.fetched(spans);
+  });
+
+  remove_journal(prefix);
+
+  REQUIRE(count == 1000);
+  REQUIRE(sum == 500500);
+}
+
+
+TEST_CASE("activity::run/journaled") {
+
+  auto const prefix = journal_prefix("activity");
+  theater::journal_options options;
+  options.segment_capacity = 256;
+  theater::journal_writer<int> journal;
+  REQUIRE(journal.open(prefix, options));
+
+  theater::activity<int> target;
+  target.reserve(64);
+  std::vector<int> handled;
+
+  target.run(theater::journaled(journal, [&](auto& batch) {
+    if(handled.size() % 2 == 0) {
+      for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+        handled.push_back(batch.take(n));
+        batch.fetched();
+      }
+    } else {
+      auto const spans = batch.try_fetch_all();
+      for(auto value: spans.head)
+        handled.push_back(value);
+      for(auto value: spans.tail)
+        handled.push_back(value);
+      batch.fetched(spans);
+    }
+  }));
+
+  for(int i = 0; i != 1000; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  target.stop();
+  REQUIRE(journal.next_sequence() == 1000);
+  journal.close();
+
+  std::vector<int> replayed;
+  theater::journal_reader<int> reader{prefix};
+  REQUIRE(reader.replay([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      replayed.push_back(batch[n]);
+      batch.fetched();
+    }
+  }) == 1000);
+
+  remove_journal(prefix);
+
+  REQUIRE(handled.size() == 1000);
+  REQUIRE(replayed == handled);
+}
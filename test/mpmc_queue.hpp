@@ -0,0 +1,169 @@
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <doctest/doctest.h>
+#include <theater/mpmc_queue.hpp>
+
+
+TEST_CASE("mpmc_queue::mpmc_queue()") {
+
+  theater::mpmc_queue<int> target;
+
+  REQUIRE(target.capacity() == 0);
+  REQUIRE(!target);
+  REQUIRE(!target.claim());
+  REQUIRE(!target.try_fetch());
+}
+
+
+TEST_CASE("mpmc_queue::claim") {
+
+  theater::mpmc_queue<int> target(1);
+  auto const c1 = target.claim();
+  auto const c2 = target.claim();
+
+  REQUIRE(c1.value() == 0);
+  REQUIRE(c2.value() == 1);
+  REQUIRE(target.size() == 2);
+  REQUIRE(!target.claim_for(std::chrono::microseconds{1}));
+  REQUIRE(target.blocks_count() == 1);
+
+  target.publish(c1);
+  auto const f1 = target.try_fetch();
+  REQUIRE(f1 == c1);
+  REQUIRE(!target.claim_for(std::chrono::microseconds{1}));
+  target.fetched(f1);
+
+  auto const c3 = target.claim_for(std::chrono::microseconds{1});
+  REQUIRE(c3.value() == 2);
+}
+
+
+TEST_CASE("mpmc_queue::try_fetch") {
+
+  theater::mpmc_queue<int> target(2);
+
+  auto const p1 = target.claim();
+  auto const p2 = target.claim();
+  target[p1] = 1;
+  target[p2] = 2;
+  target.publish(p2);
+  REQUIRE(!target.try_fetch());
+
+  target.publish(p1);
+  auto const f1 = target.try_fetch();
+  auto const f2 = target.try_fetch();
+  REQUIRE(f1 == p1);
+  REQUIRE(f2 == p2);
+  REQUIRE(!target.try_fetch());
+  REQUIRE(target[f2] == 2);
+  target.fetched(f2);
+  target.fetched(f1);
+  REQUIRE(target.size() == 0);
+}
+
+
+TEST_CASE("mpmc_queue::multithreading") {
+
+  theater::mpmc_queue<int> target(8);
+  constexpr int threads = 4;
+  constexpr int per_producer = 1000;
+  std::atomic<int> received{0};
+  std::atomic<long long> sum{0};
+
+  std::vector<std::thread> consumers;
+  for(int i = 0; i != threads; ++i)
+    consumers.emplace_back([&]{
+      while(received.load(std::memory_order_relaxed) != threads * per_producer) {
+        auto const n = target.try_fetch();
+        if(!n) {
+          std::this_thread::yield();
+          continue;
+        }
+        sum.fetch_add(target[n], std::memory_order_relaxed);
+        target.fetched(n);
+        received.fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+
+  std::vector<std::thread> producers;
+  for(int i = 0; i != threads; ++i)
+    producers.emplace_back([&]{
+      for(int n = 1; n != per_producer + 1; ++n) {
+        auto const p = target.claim();
+        target[p] = n;
+        target.publish(p);
+      }
+    });
+
+  for(auto& each: producers)
+    each.join();
+  for(auto& each: consumers)
+    each.join();
+
+  REQUIRE(sum.load() == threads * (1 + per_producer) * per_producer / 2);
+}
+
+
+TEST_CASE_TEMPLATE("mpmc_queue::fetch", W, theater::yield_wait, theater::park_wait) {
+
+  theater::mpmc_queue<int, W> target(4);
+  constexpr int threads = 2;
+  constexpr int per_producer = 1000;
+  std::atomic<long long> sum{0};
+
+  std::vector<std::thread> consumers;
+  for(int i = 0; i != threads; ++i)
+    consumers.emplace_back([&]{
+      for(int n = 0; n != per_producer; ++n) {
+        auto const p = target.fetch();
+        sum.fetch_add(target[p], std::memory_order_relaxed);
+        target.fetched(p);
+      }
+    });
+
+  std::vector<std::thread> producers;
+  for(int i = 0; i != threads; ++i)
+    producers.emplace_back([&]{
+      for(int n = 1; n != per_producer + 1; ++n) {
+        if(n % 100 == 0)
+          std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        auto const p = target.claim();
+        target[p] = n;
+        target.publish(p);
+      }
+    });
+
+  for(auto& each: producers)
+    each.join();
+  for(auto& each: consumers)
+    each.join();
+
+  REQUIRE(sum.load() == threads * (1 + per_producer) * per_producer / 2);
+  REQUIRE(!target.fetch_for(std::chrono::milliseconds{10}));
+}
+
+
+TEST_CASE_TEMPLATE("mpmc_queue::claim_for", W, theater::yield_wait, theater::park_wait) {
+
+  theater::mpmc_queue<int, W> target(2);
+  target.publish(target.claim());
+  target.publish(target.claim());
+
+  REQUIRE(!target.claim_for(std::chrono::milliseconds{10}));
+
+  std::thread consumer{[&]{
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    target.fetched(target.try_fetch());
+  }};
+
+  auto const p = target.claim_for(std::chrono::seconds{10});
+  consumer.join();
+
+  REQUIRE(!!p);
+  REQUIRE(p.value() == 2);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <doctest/doctest.h>
+#include <theater/mpsc_byte_queue.hpp>
+
+
+namespace {
+
+  bool push_text(theater::mpsc_byte_queue<>& queue, std::string const& text) {
+    auto const n = queue.claim(theater::sequence::value_type(text.size()));
+    if(!n)
+      return false;
+    std::memcpy(queue[n], text.data(), text.size());
+    queue.publish(n);
+    return true;
+  }
+
+
+  std::string pop_text(theater::mpsc_byte_queue<>& queue) {
+    auto const n = queue.try_fetch();
+    if(!n)
+      return std::string{};
+    std::string text{reinterpret_cast<char const*>(queue[n]), std::size_t(queue.record_size(n))};
+    queue.fetched();
+    return text;
+  }
+
+} // namespace
+
+
+TEST_CASE("mpsc_byte_queue::mpsc_byte_queue()") {
+
+  theater::mpsc_byte_queue<> target;
+
+  REQUIRE(!target);
+  REQUIRE(target.capacity() == 0);
+  REQUIRE(!target.claim(1));
+  REQUIRE(!target.try_fetch());
+}
+
+
+TEST_CASE("mpsc_byte_queue::claim") {
+
+  theater::mpsc_byte_queue<> target{256};
+
+  REQUIRE(target.capacity() == 256);
+  REQUIRE(target.max_record_size() == 120);
+  REQUIRE(!target.claim(121));
+  REQUIRE(!target.try_fetch());
+
+  REQUIRE(push_text(target, "hello"));
+  REQUIRE(push_text(target, ""));
+  REQUIRE(push_text(target, std::string(100, 'x')));
+  REQUIRE(target.size() == 16 + 8 + 112);
+
+  REQUIRE(pop_text(target) == "hello");
+  REQUIRE(pop_text(target).empty());
+  REQUIRE(pop_text(target) == std::string(100, 'x'));
+  REQUIRE(!target.try_fetch());
+  REQUIRE(target.size() == 0);
+}
+
+
+TEST_CASE("mpsc_byte_queue::try_fetch/wrap") {
+
+  theater::mpsc_byte_queue<> target{128};
+
+  for(int i = 0; i != 100; ++i) {
+    std::string const text(std::size_t(i % 50), char('a' + i % 26));
+    REQUIRE(push_text(target, text));
+    REQUIRE(pop_text(target) == text);
+  }
+  REQUIRE(target.size() == 0);
+}
+
+
+TEST_CASE("mpsc_byte_queue::claim_for") {
+
+  theater::mpsc_byte_queue<> target{128};
+
+  REQUIRE(push_text(target, std::string(56, 'a')));
+  REQUIRE(push_text(target, std::string(40, 'b')));
+  REQUIRE(!target.claim_for(24, std::chrono::milliseconds{10}));
+  REQUIRE(target.blocks_count() == 1);
+
+  REQUIRE(pop_text(target) == std::string(56, 'a'));
+  auto const n = target.claim_for(24, std::chrono::milliseconds{10});
+  REQUIRE(!!n);
+  target.publish(n);
+
+  REQUIRE(pop_text(target) == std::string(40, 'b'));
+  REQUIRE(target.record_size(target.try_fetch()) == 24);
+}
+
+
+TEST_CASE("mpsc_byte_queue::publish") {
+
+  theater::mpsc_byte_queue<> target{1024};
+  constexpr int producers_count = 4;
+  constexpr int per_producer = 5000;
+
+  std::vector<std::thread> producers;
+  for(int p = 0; p != producers_count; ++p)
+    producers.emplace_back([&, p]{
+      for(int i = 0; i != per_producer; ++i) {
+        std::string const text(std::size_t(1 + i % 40), char('a' + p));
+        auto const n = target.claim(theater::sequence::value_type(text.size()));
+        std::memcpy(target[n], text.data(), text.size());
+        target.publish(n);
+      }
+    });
+
+  std::vector<long long> bytes(producers_count, 0);
+  bool uniform = true;
+  for(int received = 0; received != producers_count * per_producer; ) {
+    auto const n = target.try_fetch();
+    if(!n) {
+      std::this_thread::yield();
+      continue;
+    }
+    auto const* const data = reinterpret_cast<char const*>(target[n]);
+    auto const size = target.record_size(n);
+    for(auto i = 0; i != size; ++i)
+      uniform = uniform && data[i] == data[0];
+    bytes[data[0] - 'a'] += size;
+    target.fetched();
+    ++received;
+  }
+
+  for(auto& each: producers)
+    each.join();
+
+  REQUIRE(uniform);
+
+  long long expected = 0;
+  for(int i = 0; i != per_producer; ++i)
+    expected += 1 + i % 40;
+  for(auto each: bytes)
+    REQUIRE(each == expected);
+}
@@ -3,6 +3,7 @@
 
 #include <thread>
 #include <future>
+#include <string>
 #include <doctest/doctest.h>
 #include <theater/mpsc_queue.hpp>
 
@@ -69,6 +70,36 @@ TEST_CASE("mpsc_queue::claim") {
 
   auto const c3 = target.claim_for(std::chrono::microseconds{1});
   REQUIRE(!c3);
+  REQUIRE(target.size() == 2);
+}
+
+
+TEST_CASE("mpsc_queue::claim_for") {
+
+  theater::mpsc_queue<int> target(2);
+
+  for(int i = 0; i != 2; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  REQUIRE(!target.claim_for(std::chrono::milliseconds{1}));
+  REQUIRE(target.blocks_count() == 1);
+
+  // The timed out claim left no hole
+  for(int i = 2; i != 10; ++i) {
+    auto const f = target.try_fetch();
+    REQUIRE(!!f);
+    REQUIRE(target[f] == i - 2);
+    target.fetched();
+    auto const n = target.claim_for(std::chrono::milliseconds{1});
+    REQUIRE(n.value() == i);
+    target[n] = i;
+    target.publish(n);
+  }
+
+  REQUIRE(target.size() == 2);
 }
 
 
@@ -146,3 +177,237 @@ TEST_CASE("mpsc_queue::multithreading") {
   REQUIRE(summator.get() == (from_number + to_number) * numbers_count / 2);
 }
 
+
+
+TEST_CASE("mpsc_queue::claim_n") {
+
+  theater::mpsc_queue<int> target(4);
+
+  REQUIRE(!target.claim_n(0));
+  REQUIRE(!target.claim_n(5));
+
+  auto const r1 = target.claim_n(3);
+  REQUIRE(!!r1);
+  REQUIRE(r1.first().value() == 0);
+  REQUIRE(r1.last().value() == 3);
+  REQUIRE(r1.size() == 3);
+
+  auto const r2 = target.claim_n(1);
+  REQUIRE(r2.first().value() == 3);
+
+  REQUIRE(!target.try_fetch());
+  target.publish_range(r1);
+  for(int i = 0; i != 3; ++i) {
+    auto const n = target.try_fetch();
+    REQUIRE(n.value() == i);
+    target.fetched();
+  }
+  REQUIRE(!target.try_fetch());
+}
+
+
+TEST_CASE("mpsc_queue::push/pop") {
+
+  theater::mpsc_queue<int> target(8);
+  int const input[] = {1, 2, 3, 4, 5, 6};
+  int output[8] = {};
+
+  REQUIRE(target.push(input, 6));
+  REQUIRE(target.pop(output, 8) == 6);
+  REQUIRE(output[5] == 6);
+
+  // wraps around the end of the ring
+  REQUIRE(target.push(input, 5));
+  REQUIRE(target.pop(output, 3) == 3);
+  REQUIRE(target.pop(output + 3, 8) == 2);
+  for(int i = 0; i != 5; ++i)
+    REQUIRE(output[i] == input[i]);
+
+  REQUIRE(!target.push(input, 9));
+  REQUIRE(target.pop(output, 8) == 0);
+}
+
+
+TEST_CASE("mpsc_queue::push/pop(std::string)") {
+
+  theater::mpsc_queue<std::string> target(2);
+  std::string const input[] = {"first", "second"};
+  std::string output[2];
+
+  REQUIRE(target.push(input, 2));
+  REQUIRE(target.pop(output, 2) == 2);
+  REQUIRE(output[0] == "first");
+  REQUIRE(output[1] == "second");
+}
+
+
+TEST_CASE_TEMPLATE("mpsc_queue::cell_layout", L,
+                   theater::cell_layout<false>, theater::cell_layout<true>) {
+
+  theater::mpsc_queue<int, L> target(4);
+  int const input[] = {1, 2, 3};
+  int output[4] = {};
+
+  REQUIRE(target.push(input, 3));
+  auto const n = target.try_fetch();
+  REQUIRE(target[n] == 1);
+  target.fetched();
+  REQUIRE(target.pop(output, 4) == 2);
+  REQUIRE(output[1] == 3);
+
+  // wraps around the end of the ring
+  REQUIRE(target.push(input, 3));
+  REQUIRE(target.pop(output, 4) == 3);
+  REQUIRE(output[2] == 3);
+
+  auto const p = target.claim();
+  target[p] = -3;
+  REQUIRE(!target.try_fetch());
+  target.publish(p);
+  REQUIRE(target[target.try_fetch()] == -3);
+}
+
+
+TEST_CASE_TEMPLATE("mpsc_queue::reserve(memory_options)", L,
+                   theater::split_layout, theater::cell_layout<true>) {
+
+  theater::memory_options options;
+  options.huge_pages = true;
+  options.prefault = true;
+  options.lock = true;
+
+  theater::mpsc_queue<std::string, L> target;
+  target.reserve(1 << 12, options);
+
+  REQUIRE(!!target);
+  REQUIRE(target.capacity() == 1 << 12);
+  REQUIRE(target.memory().size() >= (1 << 12) * sizeof(std::string));
+
+  for(int i = 0; i != 3 << 12; ++i) {
+    auto const n = target.claim();
+    target[n] = std::to_string(i);
+    target.publish(n);
+    auto const f = target.try_fetch();
+    REQUIRE(target[f] == std::to_string(i));
+    target.fetched();
+  }
+
+  theater::mpsc_queue<std::string, L> moved{std::move(target)};
+  REQUIRE(!!moved);
+  REQUIRE(!target);
+  REQUIRE(moved.memory().size() >= (1 << 12) * sizeof(std::string));
+}
+
+
+namespace {
+
+  // Not default constructible, counts live instances
+  struct tracked {
+    static inline int alive = 0;
+    std::string text;
+
+    explicit tracked(std::string t): text{std::move(t)} { ++alive; }
+    tracked(tracked const& other): text{other.text} { ++alive; }
+    tracked(tracked&& other) noexcept: text{std::move(other.text)} { ++alive; }
+    tracked& operator = (tracked const&) = default;
+    tracked& operator = (tracked&&) noexcept = default;
+    ~tracked() { --alive; }
+  }; // tracked
+
+} // namespace
+
+
+TEST_CASE_TEMPLATE("mpsc_queue::emplace", L,
+                   theater::split_layout, theater::cell_layout<true>) {
+
+  {
+    theater::mpsc_queue<tracked, L> target{4};
+    REQUIRE(tracked::alive == 0);
+
+    for(int i = 0; i != 10; ++i) {
+      auto const n = target.claim();
+      target.emplace(n, std::to_string(i));
+      target.publish(n);
+      REQUIRE(tracked::alive == 1);
+      auto const f = target.try_fetch();
+      tracked const taken = target.take(f);
+      target.fetched();
+      REQUIRE(taken.text == std::to_string(i));
+    }
+    REQUIRE(tracked::alive == 0);
+
+    for(int i = 0; i != 3; ++i) {
+      auto const n = target.claim();
+      target.emplace(n, "pending");
+      target.publish(n);
+    }
+    REQUIRE(tracked::alive == 3);
+  }
+
+  REQUIRE(tracked::alive == 0);
+}
+
+
+TEST_CASE("mpsc_queue::take") {
+
+  theater::mpsc_queue<std::string> target{4};
+  auto const n = target.claim();
+  target.emplace(n, 100, 'x');
+  target.publish(n);
+
+  auto const f = target.try_fetch();
+  std::string const taken = target.take(f);
+  target.fetched();
+
+  REQUIRE(taken == std::string(100, 'x'));
+  REQUIRE(target[f].empty());
+}
+
+
+TEST_CASE_TEMPLATE("mpsc_queue::fetch", W, theater::yield_wait, theater::park_wait) {
+
+  theater::mpsc_queue<int, theater::split_layout, W> target{8};
+  constexpr int count = 1000;
+
+  std::thread producer{[&]{
+    for(int i = 1; i <= count; ++i) {
+      if(i % 100 == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+      auto const n = target.claim();
+      target[n] = i;
+      target.publish(n);
+    }
+  }};
+
+  long long sum = 0;
+  for(int i = 0; i != count; ++i) {
+    auto const n = target.fetch();
+    REQUIRE(!!n);
+    sum += target[n];
+    target.fetched();
+  }
+
+  producer.join();
+  REQUIRE(sum == count * (count + 1) / 2);
+}
+
+
+TEST_CASE_TEMPLATE("mpsc_queue::fetch_for", W, theater::yield_wait, theater::park_wait) {
+
+  theater::mpsc_queue<int, theater::split_layout, W> target{8};
+
+  REQUIRE(!target.fetch_for(std::chrono::milliseconds{10}));
+
+  std::thread producer{[&]{
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    auto const n = target.claim();
+    target[n] = 42;
+    target.publish(n);
+  }};
+
+  auto const n = target.fetch_for(std::chrono::seconds{10});
+  producer.join();
+
+  REQUIRE(!!n);
+  REQUIRE(target[n] == 42);
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <doctest/doctest.h>
+#include <theater/multicast_queue.hpp>
+#include <theater/queue_batch.hpp>
+
+
+TEST_CASE("multicast_queue::multicast_queue()") {
+
+  theater::multicast_queue<int> target;
+
+  REQUIRE(target.capacity() == 0);
+  REQUIRE(target.consumers_count() == 0);
+  REQUIRE(!target);
+  REQUIRE(!target.claim());
+}
+
+
+TEST_CASE("multicast_queue::subscribe") {
+
+  theater::multicast_queue<int> target{4, 3};
+
+  for(int i = 0; i != 4; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  for(int r = 0; r != 3; ++r) {
+    auto reader = target.subscribe(r);
+    REQUIRE(reader.size() == 4);
+    for(int i = 0; i != 4; ++i) {
+      auto const n = reader.try_fetch();
+      REQUIRE(!!n);
+      REQUIRE(reader[n] == i);
+      reader.fetched();
+    }
+    REQUIRE(!reader.try_fetch());
+  }
+}
+
+
+TEST_CASE("multicast_queue::claim_for") {
+
+  theater::multicast_queue<int> target{2, 2};
+  auto fast = target.subscribe(0);
+  auto slow = target.subscribe(1);
+
+  for(int i = 0; i != 2; ++i)
+    target.publish(target.claim());
+
+  for(auto n = fast.try_fetch(); !!n; n = fast.try_fetch())
+    fast.fetched();
+
+  REQUIRE(!target.claim_for(std::chrono::milliseconds{10}));
+  REQUIRE(target.blocks_count() == 1);
+
+  slow.fetched(2);
+
+  // The timed out claim left no hole, both readers keep going
+  for(int i = 2; i != 10; ++i) {
+    auto const n = target.claim_for(std::chrono::milliseconds{10});
+    REQUIRE(n.value() == i);
+    target[n] = i;
+    target.publish(n);
+    for(auto* reader: {&fast, &slow}) {
+      auto const f = reader->try_fetch();
+      REQUIRE(f == n);
+      REQUIRE((*reader)[f] == i);
+      reader->fetched();
+    }
+  }
+}
+
+
+TEST_CASE_TEMPLATE("multicast_queue::fetch", W, theater::yield_wait, theater::park_wait) {
+
+  constexpr int readers_count = 4;
+  constexpr int count = 10000;
+  theater::multicast_queue<int, W> target{64, readers_count};
+  std::vector<long long> sums(readers_count, 0);
+
+  std::vector<std::thread> readers;
+  for(int r = 0; r != readers_count; ++r)
+    readers.emplace_back([&, r]{
+      auto reader = target.subscribe(r);
+      for(int i = 0; i != count; ++i) {
+        auto const n = reader.fetch();
+        sums[r] += reader[n];
+        reader.fetched();
+      }
+    });
+
+  for(int i = 1; i <= count; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  for(auto& each: readers)
+    each.join();
+
+  for(auto sum: sums)
+    REQUIRE(sum == (long long)count * (count + 1) / 2);
+}
+
+
+TEST_CASE("multicast_queue::reader/queue_batch") {
+
+  theater::multicast_queue<int> target{8, 1};
+  auto reader = target.subscribe(0);
+  theater::queue_batch<decltype(reader)> batch{reader};
+
+  for(int i = 0; i != 5; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  auto const spans = batch.try_fetch_all();
+  REQUIRE(spans.size() == 5);
+  int sum = 0;
+  for(int value: spans.head)
+    sum += value;
+  batch.fetched(spans);
+
+  REQUIRE(sum == 10);
+  REQUIRE(reader.size() == 0);
+}
+
+
+TEST_CASE("multicast_queue::subscribe_stage") {
+
+  theater::multicast_queue<int> target{4, 2};
+  auto first = target.subscribe_stage(0);
+  auto second = target.subscribe_stage(1, 0);
+
+  auto const n = target.claim();
+  target[n] = 1;
+  target.publish(n);
+
+  REQUIRE(!second.try_fetch());
+  REQUIRE(second.size() == 0);
+
+  auto const f = first.try_fetch();
+  REQUIRE(!!f);
+  first[f] += 10;
+  first.fetched();
+
+  auto const s = second.try_fetch();
+  REQUIRE(!!s);
+  REQUIRE(second[s] == 11);
+  second.fetched();
+  REQUIRE(!second.try_fetch());
+}
+
+
+TEST_CASE_TEMPLATE("multicast_queue::stage/fetch", W, theater::yield_wait, theater::park_wait) {
+
+  constexpr int count = 10000;
+  theater::multicast_queue<int, W> target{64, 3};
+  auto decode = target.subscribe_stage(0);
+  auto enrich = target.subscribe_stage(1, 0);
+  auto route = target.subscribe_stage(2, 1);
+  long long sum = 0;
+
+  std::thread decoder{[&]{
+    for(int i = 0; i != count; ++i) {
+      auto const n = decode.fetch();
+      decode[n] += 1;
+      decode.fetched();
+    }
+  }};
+
+  std::thread enricher{[&]{
+    for(int i = 0; i != count; ++i) {
+      auto const n = enrich.fetch();
+      enrich[n] *= 2;
+      enrich.fetched();
+    }
+  }};
+
+  std::thread router{[&]{
+    for(int i = 0; i != count; ++i) {
+      auto const n = route.fetch();
+      sum += route[n];
+      route.fetched();
+    }
+  }};
+
+  for(int i = 0; i != count; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  decoder.join();
+  enricher.join();
+  router.join();
+
+  REQUIRE(sum == (long long)count * (count + 1));
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+
+#include <vector>
+#include <doctest/doctest.h>
+#include <theater/numa.hpp>
+#include <theater/mpsc_queue.hpp>
+#include <theater/activity.hpp>
+
+
+TEST_CASE("numa_node::numa_node") {
+
+  theater::numa_node const none;
+  REQUIRE(!none);
+
+  auto const local = theater::numa_node::local();
+  REQUIRE(!!local);
+  REQUIRE(local.is_local());
+
+  auto const current = theater::numa_node::current();
+#if defined(__linux__)
+  REQUIRE(current.value() >= 0);
+#endif
+}
+
+
+TEST_CASE("bind_to_numa_node") {
+
+  std::vector<char> memory(1 << 20);
+
+  REQUIRE(!theater::bind_to_numa_node(memory.data(), memory.size(), theater::numa_node{}));
+  REQUIRE(!theater::bind_to_numa_node(memory.data(), memory.size(), theater::numa_node{4096}));
+  // no whole page inside, nothing is bound
+  REQUIRE(!theater::bind_to_numa_node(memory.data() + 1, 64, theater::numa_node{0}));
+  // result depends on the system, memory has to stay usable anyway
+  theater::bind_to_numa_node(memory.data(), memory.size(), theater::numa_node::local());
+  memory.back() = 1;
+  REQUIRE(memory.back() == 1);
+}
+
+
+TEST_CASE("activity::run(numa_node)") {
+
+  theater::activity<int> target;
+  target.reserve(1 << 16, theater::numa_node::local());
+  std::atomic<int> sum{0};
+
+  REQUIRE(target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      sum.fetch_add(batch[n], std::memory_order_relaxed);
+      batch.fetched();
+    }
+  }, theater::numa_node::local()));
+
+  for(int i = 1; i != 101; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  target.stop();
+  REQUIRE(sum.load() == 5050);
+}
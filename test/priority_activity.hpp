@@ -0,0 +1,119 @@
+#pragma once
+
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <doctest/doctest.h>
+#include <theater/priority_activity.hpp>
+
+
+TEST_CASE("priority_activity::run") {
+
+  theater::priority_activity<int, 2> target;
+  target.reserve(64);
+  std::vector<std::size_t> lanes;
+
+  for(int i = 0; i != 10; ++i) {
+    auto const n = target.claim(1);
+    target.at(1, n) = i;
+    target.publish(1, n);
+  }
+  auto const n = target.claim(0);
+  target.at(0, n) = -1;
+  target.publish(0, n);
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      lanes.push_back(batch.lane());
+      batch.fetched();
+    }
+  });
+
+  target.stop();
+  REQUIRE(lanes.size() == 11);
+  REQUIRE(lanes.front() == 0);
+}
+
+
+TEST_CASE("priority_activity::stop") {
+
+  theater::priority_activity<int, 2> target;
+  target.reserve(64);
+  std::atomic<int> calls{0};
+
+  // Handler leaves messages in the lanes, the worker should still stop
+  target.run([&](auto&) {
+    calls.fetch_add(1, std::memory_order_relaxed);
+  });
+
+  for(std::size_t lane = 0; lane != 2; ++lane) {
+    auto const n = target.claim(lane);
+    target.at(lane, n) = 1;
+    target.publish(lane, n);
+  }
+
+  while(calls.load(std::memory_order_relaxed) == 0)
+    std::this_thread::yield();
+
+  target.stop();
+  REQUIRE(!target.active());
+}
+
+
+TEST_CASE("priority_activity::set_weight") {
+
+  theater::priority_activity<int, 2> target;
+  target.reserve(64);
+  target.set_weight(0, 4);
+  target.set_weight(1, 2);
+  std::vector<std::size_t> lanes;
+
+  for(int i = 0; i != 8; ++i)
+    for(std::size_t lane = 0; lane != 2; ++lane) {
+      auto const n = target.claim(lane);
+      target.at(lane, n) = i;
+      target.publish(lane, n);
+    }
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      lanes.push_back(batch.lane());
+      batch.fetched();
+    }
+  });
+
+  target.stop();
+
+  std::vector<std::size_t> const expected{
+    0, 0, 0, 0, 1, 1,
+    0, 0, 0, 0, 1, 1,
+    1, 1,
+    1, 1};
+  REQUIRE(lanes == expected);
+}
+
+
+TEST_CASE("priority_activity::publish") {
+
+  theater::priority_activity<int, 3> target;
+  target.reserve(16);
+  std::atomic<int> sum{0};
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      sum.fetch_add(batch[n], std::memory_order_relaxed);
+      batch.fetched();
+    }
+  });
+
+  for(int i = 1; i != 1001; ++i) {
+    std::size_t const lane = std::size_t(i % 3);
+    auto const n = target.claim(lane);
+    target.at(lane, n) = i;
+    target.publish(lane, n);
+  }
+
+  target.stop();
+  REQUIRE(sum.load() == 500500);
+}
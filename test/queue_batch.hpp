@@ -0,0 +1,74 @@
+#pragma once
+
+
+#include <numeric>
+#include <doctest/doctest.h>
+#include <theater/mpsc_queue.hpp>
+#include <theater/spsc_queue.hpp>
+#include <theater/queue_batch.hpp>
+
+
+TEST_CASE_TEMPLATE("queue_batch::try_fetch_all", Q,
+                   theater::mpsc_queue<int>, theater::spsc_queue<int>) {
+
+  Q queue(4);
+  theater::queue_batch<Q> target(queue);
+
+  REQUIRE(target.try_fetch_all().empty());
+
+  for(int i = 1; i != 4; ++i) {
+    auto const n = queue.claim();
+    queue[n] = i;
+    queue.publish(n);
+  }
+
+  auto const s1 = target.try_fetch_all();
+  REQUIRE(s1.size() == 3);
+  REQUIRE(s1.tail.empty());
+  REQUIRE(std::accumulate(s1.head.begin(), s1.head.end(), 0) == 6);
+  target.fetched(s1);
+  REQUIRE(queue.size() == 0);
+
+  // wraps around the end of the ring
+  for(int i = 4; i != 7; ++i) {
+    auto const n = queue.claim();
+    queue[n] = i;
+    queue.publish(n);
+  }
+
+  auto const s2 = target.try_fetch_all();
+  REQUIRE(s2.size() == 3);
+  REQUIRE(s2.head.size() == 1);
+  REQUIRE(s2.head[0] == 4);
+  int expected = 5;
+  for(int each: s2.tail)
+    REQUIRE(each == expected++);
+  target.fetched(s2);
+  REQUIRE(target.try_fetch_all().empty());
+}
+
+
+TEST_CASE_TEMPLATE("queue_batch::fetched(spans)", Q,
+                   theater::mpsc_queue<tracked>, theater::spsc_queue<tracked>) {
+
+  {
+    Q queue(4);
+    theater::queue_batch<Q> target(queue);
+
+    for(int lap = 0; lap != 3; ++lap) {
+      for(int i = 0; i != 3; ++i) {
+        auto const n = queue.claim();
+        queue.emplace(n, std::to_string(i));
+        queue.publish(n);
+      }
+      REQUIRE(tracked::alive == 3);
+
+      auto const s = target.try_fetch_all();
+      REQUIRE(s.size() == 3);
+      target.fetched(s);
+      REQUIRE(tracked::alive == 0);
+    }
+  }
+
+  REQUIRE(tracked::alive == 0);
+}
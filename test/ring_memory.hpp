@@ -0,0 +1,128 @@
+#pragma once
+
+
+#include <cstddef>
+#include <memory_resource>
+#include <doctest/doctest.h>
+#include <theater/ring_memory.hpp>
+#include <theater/mpsc_queue.hpp>
+#include <theater/spsc_queue.hpp>
+#include <theater/mpmc_queue.hpp>
+#include <theater/segmented_mpsc_queue.hpp>
+#include <theater/activity.hpp>
+
+
+namespace {
+
+  struct counting_resource: std::pmr::memory_resource {
+
+    std::size_t allocated{0};
+    std::size_t deallocated{0};
+
+  private:
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+      allocated += bytes;
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+      deallocated += bytes;
+      std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override {
+      return this == &other;
+    }
+
+  }; // counting_resource
+
+} // namespace
+
+
+TEST_CASE("ring_memory::ring_memory") {
+
+  theater::ring_memory empty;
+  REQUIRE(!empty);
+
+  theater::ring_memory heap{100};
+  REQUIRE(!!heap);
+  REQUIRE(heap.size() == 100);
+  REQUIRE(std::size_t(heap.data()) % theater::ring_memory::cacheline == 0);
+
+  theater::memory_options options;
+  options.prefault = true;
+  theater::ring_memory mapped{100, options};
+  REQUIRE(!!mapped);
+  REQUIRE(!mapped.huge_pages());
+
+  theater::ring_memory moved{std::move(mapped)};
+  REQUIRE(!!moved);
+  REQUIRE(!mapped);
+}
+
+
+TEST_CASE("ring_memory::resource") {
+
+  counting_resource resource;
+  theater::memory_options options;
+  options.resource = &resource;
+
+  {
+    theater::ring_memory memory{1000, options};
+    REQUIRE(resource.allocated == 1000);
+  }
+
+  REQUIRE(resource.deallocated == 1000);
+}
+
+
+TEST_CASE_TEMPLATE("memory_options::resource", Q,
+                   theater::mpsc_queue<int>, theater::spsc_queue<int>,
+                   theater::mpmc_queue<int>, theater::segmented_mpsc_queue<int>) {
+
+  counting_resource resource;
+  theater::memory_options options;
+  options.resource = &resource;
+
+  {
+    Q target(64, options);
+    REQUIRE(resource.allocated >= 64 * sizeof(int));
+
+    auto const n = target.claim();
+    target[n] = -3;
+    target.publish(n);
+    auto const f = target.try_fetch();
+    REQUIRE(target[f] == -3);
+  }
+
+  REQUIRE(resource.deallocated == resource.allocated);
+}
+
+
+TEST_CASE("activity::reserve(memory_options)") {
+
+  std::pmr::monotonic_buffer_resource arena{1 << 16};
+  theater::memory_options options;
+  options.resource = &arena;
+
+  theater::activity<int> target;
+  target.reserve(128, options);
+  std::atomic<int> sum{0};
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      sum.fetch_add(batch[n], std::memory_order_relaxed);
+      batch.fetched();
+    }
+  });
+
+  for(int i = 1; i != 101; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  target.stop();
+  REQUIRE(sum.load() == 5050);
+}
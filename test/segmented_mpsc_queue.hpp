@@ -0,0 +1,213 @@
+#pragma once
+
+
+#include <atomic>
+#include <future>
+#include <thread>
+#include <chrono>
+#include <doctest/doctest.h>
+#include <theater/segmented_mpsc_queue.hpp>
+#include <theater/activity.hpp>
+
+
+TEST_CASE("segmented_mpsc_queue::segmented_mpsc_queue()") {
+
+  theater::segmented_mpsc_queue<int> target;
+
+  REQUIRE(!target);
+  REQUIRE(target.capacity() == 0);
+  REQUIRE(!target.claim());
+}
+
+
+TEST_CASE("segmented_mpsc_queue::claim") {
+
+  theater::segmented_mpsc_queue<int> target(2, 2);
+
+  REQUIRE(target.segment_capacity() == 2);
+  REQUIRE(target.capacity() == 4);
+  REQUIRE(target.segments_count() == 1);
+
+  for(int i = 0; i != 4; ++i) {
+    auto const n = target.claim();
+    REQUIRE(n.value() == i);
+    target[n] = i;
+    target.publish(n);
+  }
+
+  REQUIRE(target.segments_count() == 2);
+  REQUIRE(!target.claim_for(std::chrono::microseconds{1}));
+  REQUIRE(target.blocks_count() == 1);
+}
+
+
+TEST_CASE("segmented_mpsc_queue::wraps directory") {
+
+  theater::segmented_mpsc_queue<int> target(2, 2);
+
+  for(int i = 0; i != 4; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  REQUIRE(target[target.try_fetch()] == 0);
+  target.fetched();
+
+  // Segment of 4 shares the directory slot with the one being drained
+  REQUIRE(!target.claim_for(std::chrono::milliseconds{1}));
+
+  int expected = 1;
+  for(int i = 4; i != 100; ++i) {
+    auto n = target.claim_for(std::chrono::milliseconds{1});
+    while(!n) {
+      auto const f = target.try_fetch();
+      REQUIRE(!!f);
+      REQUIRE(target[f] == expected++);
+      target.fetched();
+      n = target.claim_for(std::chrono::milliseconds{1});
+    }
+    REQUIRE(n.value() == i);
+    target[n] = i;
+    target.publish(n);
+  }
+
+  for(auto f = target.try_fetch(); !!f; f = target.try_fetch()) {
+    REQUIRE(target[f] == expected++);
+    target.fetched();
+  }
+
+  REQUIRE(expected == 100);
+  REQUIRE(target.segments_count() == 2);
+}
+
+
+TEST_CASE("segmented_mpsc_queue::grows and recycles") {
+
+  theater::segmented_mpsc_queue<int> target(4);
+
+  for(int i = 0; i != 16; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  REQUIRE(target.size() == 16);
+  REQUIRE(target.segments_count() == 4);
+
+  for(int i = 0; i != 16; ++i) {
+    auto const n = target.try_fetch();
+    REQUIRE(!!n);
+    REQUIRE(target[n] == i);
+    target.fetched();
+  }
+
+  REQUIRE(!target.try_fetch());
+
+  for(int i = 0; i != 16; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+    auto const f = target.try_fetch();
+    REQUIRE(f == n);
+    REQUIRE(target[f] == i);
+    target.fetched();
+  }
+
+  REQUIRE(target.segments_count() == 4);
+}
+
+
+TEST_CASE("segmented_mpsc_queue::multithreading") {
+
+  theater::segmented_mpsc_queue<int> target(4);
+  constexpr auto from_number = 1;
+  constexpr auto to_number = 1000;
+  constexpr auto numbers_count = to_number - from_number + 1;
+
+  auto summator = std::async(std::launch::async, [&]{
+    auto count = 0, sum = 0;
+    while(count != numbers_count) {
+      auto const p = target.try_fetch();
+      if(!p) {
+        std::this_thread::yield();
+        continue;
+      }
+      sum += target[p];
+      target.fetched();
+      ++count;
+    }
+    return sum;
+  });
+
+  auto const half = (from_number + to_number) / 2;
+  auto producer = std::async(std::launch::async, [&]{
+    for(auto n = from_number; n != half; ++n) {
+      auto const p = target.claim();
+      target[p] = n;
+      target.publish(p);
+    }
+  });
+
+  for(auto n = half; n != to_number + 1; ++n) {
+    auto const p = target.claim();
+    target[p] = n;
+    target.publish(p);
+  }
+
+  producer.get();
+  REQUIRE(summator.get() == (from_number + to_number) * numbers_count / 2);
+}
+
+
+TEST_CASE("segmented_mpsc_queue::activity") {
+
+  theater::activity<int, theater::segmented_mpsc_queue<int>> target;
+  target.reserve(4);
+  std::atomic<int> sum{0};
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      sum.fetch_add(batch[n], std::memory_order_relaxed);
+      batch.fetched();
+    }
+  });
+
+  for(int i = 1; i != 101; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  target.stop();
+  REQUIRE(sum.load() == 5050);
+}
+
+
+TEST_CASE_TEMPLATE("segmented_mpsc_queue::fetch", W, theater::yield_wait, theater::park_wait) {
+
+  theater::segmented_mpsc_queue<int, W> target(2, 2);
+  constexpr int count = 1000;
+
+  std::thread producer{[&]{
+    for(int i = 1; i <= count; ++i) {
+      if(i % 100 == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+      auto const n = target.claim();
+      target[n] = i;
+      target.publish(n);
+    }
+  }};
+
+  long long sum = 0;
+  for(int i = 0; i != count; ++i) {
+    auto const n = target.fetch();
+    REQUIRE(!!n);
+    sum += target[n];
+    target.fetched();
+  }
+
+  producer.join();
+  REQUIRE(sum == count * (count + 1) / 2);
+  REQUIRE(!target.fetch_for(std::chrono::milliseconds{10}));
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+
+#include <chrono>
+#include <string>
+#include <doctest/doctest.h>
+#include <theater/shared_mpsc_queue.hpp>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+namespace {
+
+  std::string shared_name(char const* suffix) {
+    return "/theater_test_" + std::to_string(::getpid()) + "_" + suffix;
+  }
+
+
+  std::string shared_path(char const* suffix) {
+    return "/tmp/theater_test_" + std::to_string(::getpid()) + "_" + suffix;
+  }
+
+} // namespace
+
+
+TEST_CASE("shared_mpsc_queue::shared_mpsc_queue()") {
+
+  theater::shared_mpsc_queue<int> target;
+  REQUIRE(!target);
+  REQUIRE(target.capacity() == 0);
+  REQUIRE(target.size() == 0);
+  REQUIRE(target.blocks_count() == 0);
+  REQUIRE(!target.claim());
+  REQUIRE(!target.try_fetch());
+}
+
+
+TEST_CASE("shared_mpsc_queue::open") {
+
+  auto const name = shared_name("open");
+  theater::shared_mpsc_queue<int> consumer;
+  theater::shared_mpsc_queue<int> producer;
+  theater::shared_mpsc_queue<double> other;
+
+  REQUIRE(!producer.open(name.c_str()));
+  REQUIRE(consumer.create(name.c_str(), 6));
+  REQUIRE(consumer.capacity() == 8);
+  REQUIRE(producer.open(name.c_str()));
+  REQUIRE(producer.capacity() == 8);
+  REQUIRE(!other.open(name.c_str()));
+
+  for(int i = 0; i != 20; ++i) {
+    auto const n = producer.claim();
+    producer[n] = i;
+    producer.publish(n);
+    auto const f = consumer.try_fetch();
+    REQUIRE(!!f);
+    REQUIRE(consumer[f] == i);
+    consumer.fetched();
+  }
+
+  REQUIRE(!consumer.fetch_for(std::chrono::milliseconds{10}));
+  REQUIRE(theater::shared_mpsc_queue<int>::remove(name.c_str()));
+  REQUIRE(!other.open(name.c_str()));
+}
+
+
+TEST_CASE("shared_mpsc_queue::claim_for") {
+
+  auto const name = shared_name("claim_for");
+  theater::shared_mpsc_queue<int> target;
+  REQUIRE(target.create(name.c_str(), 2));
+
+  for(int i = 0; i != 2; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  REQUIRE(!target.claim_for(std::chrono::milliseconds{1}));
+  REQUIRE(target.blocks_count() == 1);
+  REQUIRE(target.size() == 2);
+
+  for(int i = 2; i != 10; ++i) {
+    auto const f = target.try_fetch();
+    REQUIRE(!!f);
+    REQUIRE(target[f] == i - 2);
+    target.fetched();
+    auto const n = target.claim_for(std::chrono::milliseconds{1});
+    REQUIRE(n.value() == i);
+    target[n] = i;
+    target.publish(n);
+  }
+
+  REQUIRE(target.size() == 2);
+  theater::shared_mpsc_queue<int>::remove(name.c_str());
+}
+
+
+TEST_CASE("shared_mpsc_queue::fetch") {
+
+  auto const name = shared_name("fetch");
+  theater::shared_mpsc_queue<int> consumer;
+  REQUIRE(consumer.create(name.c_str(), 16));
+  constexpr int count = 10000;
+
+  pid_t const child = ::fork();
+  REQUIRE(child != -1);
+
+  if(child == 0) {
+    theater::shared_mpsc_queue<int> producer;
+    if(!producer.open(name.c_str()))
+      ::_exit(1);
+    for(int i = 1; i <= count; ++i) {
+      auto const n = producer.claim();
+      producer[n] = i;
+      producer.publish(n);
+    }
+    ::_exit(0);
+  }
+
+  long long sum = 0;
+  for(int i = 0; i != count; ++i) {
+    auto const n = consumer.fetch();
+    sum += consumer[n];
+    consumer.fetched();
+  }
+
+  int status = 0;
+  ::waitpid(child, &status, 0);
+  theater::shared_mpsc_queue<int>::remove(name.c_str());
+
+  REQUIRE(WIFEXITED(status));
+  REQUIRE(WEXITSTATUS(status) == 0);
+  REQUIRE(sum == (long long)count * (count + 1) / 2);
+}
+
+
+TEST_CASE("shared_mpsc_queue::open_file") {
+
+  auto const path = shared_path("open_file");
+  theater::shared_mpsc_queue<int> producer;
+  REQUIRE(producer.create_file(path.c_str(), 16));
+
+  for(int i = 0; i != 10; ++i) {
+    auto const n = producer.claim();
+    producer[n] = i;
+    producer.publish(n);
+  }
+  REQUIRE(producer.sync());
+
+  {
+    theater::shared_mpsc_queue<int> consumer;
+    REQUIRE(consumer.open_file(path.c_str()));
+    for(int i = 0; i != 3; ++i) {
+      auto const n = consumer.try_fetch();
+      REQUIRE(consumer[n] == i);
+      consumer.fetched();
+    }
+    // Restarts before the element is marked fetched
+    auto const n = consumer.try_fetch();
+    REQUIRE(consumer[n] == 3);
+  }
+
+  producer.close();
+  theater::shared_mpsc_queue<double> other;
+  REQUIRE(!other.open_file(path.c_str()));
+
+  theater::shared_mpsc_queue<int> consumer;
+  REQUIRE(consumer.open_file(path.c_str()));
+  REQUIRE(consumer.capacity() == 16);
+  REQUIRE(consumer.size() == 7);
+  for(int i = 3; i != 10; ++i) {
+    auto const n = consumer.try_fetch();
+    REQUIRE(!!n);
+    REQUIRE(consumer[n] == i);
+    consumer.fetched();
+  }
+  REQUIRE(!consumer.try_fetch());
+
+  REQUIRE(theater::shared_mpsc_queue<int>::remove_file(path.c_str()));
+  REQUIRE(!other.open_file(path.c_str()));
+}
+
+
+TEST_CASE("shared_mpsc_queue::open_file/claim_for") {
+
+  auto const path = shared_path("open_file_claim_for");
+  {
+    theater::shared_mpsc_queue<int> producer;
+    REQUIRE(producer.create_file(path.c_str(), 2));
+    for(int i = 0; i != 2; ++i) {
+      auto const n = producer.claim();
+      producer[n] = i;
+      producer.publish(n);
+    }
+    REQUIRE(!producer.claim_for(std::chrono::milliseconds{1}));
+  }
+
+  // The timed out claim is not in the file, no recover() is needed
+  theater::shared_mpsc_queue<int> consumer;
+  REQUIRE(consumer.open_file(path.c_str()));
+  REQUIRE(consumer.size() == 2);
+  theater::shared_mpsc_queue<int> producer;
+  REQUIRE(producer.open_file(path.c_str()));
+
+  for(int i = 0; i != 10; ++i) {
+    auto const f = consumer.try_fetch();
+    REQUIRE(!!f);
+    REQUIRE(consumer[f] == i);
+    consumer.fetched();
+    auto const n = producer.claim_for(std::chrono::milliseconds{1});
+    REQUIRE(n.value() == i + 2);
+    producer[n] = i + 2;
+    producer.publish(n);
+  }
+
+  REQUIRE(consumer.size() == 2);
+  theater::shared_mpsc_queue<int>::remove_file(path.c_str());
+}
+
+
+TEST_CASE("shared_mpsc_queue::recover") {
+
+  auto const path = shared_path("recover");
+  {
+    theater::shared_mpsc_queue<int> producer;
+    REQUIRE(producer.create_file(path.c_str(), 4));
+    auto const first = producer.claim();
+    auto const lost = producer.claim();
+    auto const third = producer.claim();
+    producer[first] = 1;
+    producer.publish(first);
+    producer[third] = 3;
+    producer.publish(third);
+    REQUIRE(!!lost);
+  }
+
+  theater::shared_mpsc_queue<int> consumer;
+  REQUIRE(consumer.open_file(path.c_str()));
+  REQUIRE(consumer.recover() == 1);
+  REQUIRE(consumer.size() == 1);
+
+  theater::shared_mpsc_queue<int> producer;
+  REQUIRE(producer.open_file(path.c_str()));
+  for(int i = 2; i != 7; ++i) {
+    auto const n = producer.claim_for(std::chrono::milliseconds{10});
+    if(!n)
+      break;
+    producer[n] = i;
+    producer.publish(n);
+  }
+
+  for(int i = 1; i != 5; ++i) {
+    auto const n = consumer.try_fetch();
+    REQUIRE(!!n);
+    REQUIRE(consumer[n] == i);
+    consumer.fetched();
+  }
+  REQUIRE(!consumer.try_fetch());
+
+  theater::shared_mpsc_queue<int>::remove_file(path.c_str());
+}
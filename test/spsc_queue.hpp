@@ -0,0 +1,223 @@
+#pragma once
+
+
+#include <thread>
+#include <future>
+#include <chrono>
+#include <doctest/doctest.h>
+#include <theater/spsc_queue.hpp>
+#include <theater/activity.hpp>
+
+
+TEST_CASE("spsc_queue::spsc_queue()") {
+
+  theater::spsc_queue<int> target;
+
+  REQUIRE(target.capacity() == 0);
+  REQUIRE(!target);
+  REQUIRE(target.size() == 0);
+}
+
+
+TEST_CASE("spsc_queue::spsc_queue(spsc_queue&&)") {
+
+  using queue = theater::spsc_queue<int>;
+  queue target(6);
+  auto const n = target.claim();
+  target.publish(n);
+  queue moved1{std::move(target)};
+
+  REQUIRE(!!moved1);
+  REQUIRE(moved1.capacity() == 8);
+  REQUIRE(moved1.size() == 1);
+  REQUIRE(!target);
+  REQUIRE(target.capacity() == 0);
+  REQUIRE(target.size() == 0);
+
+  queue moved2;
+  moved2 = std::move(moved1);
+
+  REQUIRE(!!moved2);
+  REQUIRE(moved2.capacity() == 8);
+  REQUIRE(moved2.size() == 1);
+  REQUIRE(!moved1);
+  REQUIRE(moved1.size() == 0);
+}
+
+
+TEST_CASE("spsc_queue::claim") {
+
+  theater::spsc_queue<int> target(1);
+  auto const c1 = target.claim();
+  REQUIRE(!!c1);
+  REQUIRE(c1.value() == 0);
+
+  auto const c2 = target.claim();
+  REQUIRE(!!c2);
+  REQUIRE(c2.value() == 1);
+
+  auto const c3 = target.claim_for(std::chrono::microseconds{1});
+  REQUIRE(!c3);
+  REQUIRE(target.blocks_count() == 1);
+
+  target.publish(c2);
+  REQUIRE(target.size() == 2);
+  REQUIRE(target.try_fetch() == c1);
+  target.fetched();
+
+  auto const c4 = target.claim_for(std::chrono::microseconds{1});
+  REQUIRE(!!c4);
+  REQUIRE(c4.value() == 2);
+}
+
+
+TEST_CASE("spsc_queue::try_fetch") {
+
+  theater::spsc_queue<int> target(1);
+
+  REQUIRE(!target.try_fetch());
+
+  auto const p1 = target.claim();
+  target[p1] = -3;
+  REQUIRE(!target.try_fetch());
+
+  target.publish(p1);
+
+  auto const f1 = target.try_fetch();
+  REQUIRE(f1 == p1);
+  REQUIRE(target[f1] == -3);
+  target.fetched();
+  REQUIRE(!target.try_fetch());
+  REQUIRE(target.size() == 0);
+}
+
+
+TEST_CASE("spsc_queue::multithreading") {
+
+  theater::spsc_queue<int> target(4);
+  constexpr auto from_number = 1;
+  constexpr auto to_number = 1000;
+  constexpr auto numbers_count = to_number - from_number + 1;
+
+  auto summator = std::async(std::launch::async, [&]{
+    auto count = 0, sum = 0;
+    while(count != numbers_count) {
+      auto const p = target.try_fetch();
+      if(!p) {
+        std::this_thread::yield();
+        continue;
+      }
+      sum += target[p];
+      target.fetched();
+      ++count;
+    }
+    return sum;
+  });
+
+  for(auto n = from_number; n != to_number + 1; ++n) {
+    auto const p = target.claim();
+    target[p] = n;
+    target.publish(p);
+  }
+
+  REQUIRE(summator.get() == (from_number + to_number) * numbers_count / 2);
+}
+
+
+TEST_CASE("spsc_queue::activity") {
+
+  theater::activity<int, theater::spsc_queue<int>> target;
+  target.reserve(16);
+  std::atomic<int> sum{0};
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      sum.fetch_add(batch[n], std::memory_order_relaxed);
+      batch.fetched();
+    }
+  });
+
+  for(int i = 1; i != 101; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  target.stop();
+  REQUIRE(sum.load() == 5050);
+}
+
+
+TEST_CASE("spsc_queue::emplace") {
+
+  {
+    theater::spsc_queue<tracked> target{4};
+
+    for(int i = 0; i != 10; ++i) {
+      auto const n = target.claim();
+      target.emplace(n, std::to_string(i));
+      target.publish(n);
+      auto const f = target.try_fetch();
+      tracked const taken = target.take(f);
+      target.fetched();
+      REQUIRE(taken.text == std::to_string(i));
+    }
+    REQUIRE(tracked::alive == 0);
+
+    auto const n = target.claim();
+    target.emplace(n, "pending");
+    target.publish(n);
+    REQUIRE(tracked::alive == 1);
+  }
+
+  REQUIRE(tracked::alive == 0);
+}
+
+
+TEST_CASE_TEMPLATE("spsc_queue::fetch", W, theater::yield_wait, theater::park_wait) {
+
+  theater::spsc_queue<int, theater::split_layout, W> target{4};
+  constexpr int count = 1000;
+
+  std::thread producer{[&]{
+    for(int i = 1; i <= count; ++i) {
+      if(i % 100 == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+      auto const n = target.claim();
+      target[n] = i;
+      target.publish(n);
+    }
+  }};
+
+  long long sum = 0;
+  for(int i = 0; i != count; ++i) {
+    auto const n = target.fetch();
+    REQUIRE(!!n);
+    sum += target[n];
+    target.fetched();
+  }
+
+  producer.join();
+  REQUIRE(sum == count * (count + 1) / 2);
+}
+
+
+TEST_CASE_TEMPLATE("spsc_queue::fetch_for", W, theater::yield_wait, theater::park_wait) {
+
+  theater::spsc_queue<int, theater::split_layout, W> target{4};
+
+  REQUIRE(!target.fetch_for(std::chrono::milliseconds{10}));
+
+  std::thread producer{[&]{
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    auto const n = target.claim();
+    target[n] = 42;
+    target.publish(n);
+  }};
+
+  auto const n = target.fetch_for(std::chrono::seconds{10});
+  producer.join();
+
+  REQUIRE(!!n);
+  REQUIRE(target[n] == 42);
+}
@@ -2,5 +2,21 @@
 #include <doctest/doctest.h>
 
 #include "mpsc_queue.hpp"
+#include "spsc_queue.hpp"
+#include "mpmc_queue.hpp"
+#include "segmented_mpsc_queue.hpp"
+#include "multicast_queue.hpp"
+#include "mpsc_byte_queue.hpp"
+#include "intrusive_mpsc_queue.hpp"
+#if defined(__linux__)
+#include "shared_mpsc_queue.hpp"
+#include "journal.hpp"
+#endif
+#include "fixed_queue.hpp"
+#include "numa.hpp"
+#include "ring_memory.hpp"
+#include "wait_strategy.hpp"
+#include "queue_batch.hpp"
 #include "atomic_cv.hpp"
 #include "activity.hpp"
+#include "priority_activity.hpp"
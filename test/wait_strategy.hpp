@@ -0,0 +1,150 @@
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <doctest/doctest.h>
+#include <theater/wait_strategy.hpp>
+#include <theater/mpsc_queue.hpp>
+#include <theater/activity.hpp>
+
+
+TEST_CASE_TEMPLATE("wait_strategy::wait_for", W, theater::spin_wait,
+                   theater::backoff_wait, theater::yield_wait, theater::park_wait) {
+
+  W target;
+  std::atomic<bool> ready{false};
+
+  REQUIRE(!target.wait_for([&]{ return ready.load(); }, std::chrono::milliseconds{10}));
+
+  std::thread notifier{[&]{
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    ready.store(true);
+    target.notify();
+  }};
+
+  REQUIRE(target.wait_for([&]{ return ready.load(); }, std::chrono::seconds{10}));
+  notifier.join();
+}
+
+
+TEST_CASE_TEMPLATE("mpsc_queue::claim/wait_strategy", W, theater::spin_wait,
+                   theater::backoff_wait, theater::yield_wait, theater::park_wait) {
+
+  theater::mpsc_queue<int, theater::split_layout, W> target{4};
+  constexpr int per_producer = 1000;
+  std::vector<std::thread> producers;
+
+  for(int i = 0; i != 2; ++i)
+    producers.emplace_back([&]{
+      for(int j = 0; j != per_producer; ++j) {
+        auto const n = target.claim();
+        target[n] = 1;
+        target.publish(n);
+      }
+    });
+
+  int sum = 0;
+  while(sum != 2 * per_producer) {
+    auto const n = target.try_fetch();
+    if(!n) {
+      std::this_thread::yield();
+      continue;
+    }
+    sum += target[n];
+    target.fetched();
+  }
+
+  for(auto& each: producers)
+    each.join();
+
+  REQUIRE(sum == 2 * per_producer);
+  REQUIRE(target.blocks_count() != 0);
+}
+
+
+TEST_CASE_TEMPLATE("mpsc_queue::claim_for/wait_strategy", W, theater::spin_wait,
+                   theater::backoff_wait, theater::yield_wait, theater::park_wait) {
+
+  theater::mpsc_queue<int, theater::split_layout, W> target{2};
+  for(int i = 0; i != 2; ++i)
+    target.publish(target.claim());
+
+  REQUIRE(!target.claim_for(std::chrono::milliseconds{10}));
+}
+
+
+TEST_CASE_TEMPLATE("activity::run/wait_strategy", W, theater::spin_wait,
+                   theater::backoff_wait, theater::yield_wait, theater::park_wait) {
+
+  theater::activity<int, theater::mpsc_queue<int>, W> target;
+  target.reserve(16);
+  std::atomic<int> sum{0};
+
+  target.run([&](auto& batch) {
+    for(auto n = batch.try_fetch(); !!n; n = batch.try_fetch()) {
+      sum.fetch_add(batch[n], std::memory_order_relaxed);
+      batch.fetched();
+    }
+  });
+
+  for(int i = 1; i != 1001; ++i) {
+    auto const n = target.claim();
+    target[n] = i;
+    target.publish(n);
+  }
+
+  target.stop();
+  REQUIRE(sum.load() == 500500);
+}
+
+
+TEST_CASE("park_wait::notify(progress)") {
+
+  theater::park_wait target;
+  std::atomic<int64_t> progress{0};
+  std::atomic<bool> done{false};
+
+  std::thread waiter{[&]{
+    target.wait([&]{ return progress.load() >= 10; }, 10);
+    done.store(true);
+  }};
+
+  std::this_thread::sleep_for(std::chrono::milliseconds{20});
+  progress.store(5);
+  target.notify(5);
+  std::this_thread::sleep_for(std::chrono::milliseconds{20});
+  REQUIRE(!done.load());
+  REQUIRE(target.wakes_count() == 0);
+
+  progress.store(10);
+  target.notify(10);
+  waiter.join();
+  REQUIRE(done.load());
+  REQUIRE(target.wakes_count() == 1);
+}
+
+
+TEST_CASE("mpsc_queue::wakes_count") {
+
+  theater::mpsc_queue<int, theater::split_layout, theater::park_wait> target{2};
+  for(int i = 0; i != 2; ++i)
+    target.publish(target.claim());
+
+  std::thread producer{[&]{
+    target.publish(target.claim());
+  }};
+
+  std::this_thread::sleep_for(std::chrono::milliseconds{20});
+  REQUIRE(target.blocks_count() == 1);
+  REQUIRE(target.wakes_count() == 0);
+
+  REQUIRE(!!target.try_fetch());
+  target.fetched();
+  producer.join();
+
+  REQUIRE(target.wakes_count() == 1);
+  REQUIRE(target.size() == 2);
+}